@@ -2,9 +2,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir {
@@ -19,25 +22,71 @@ struct dir_entry {
 	bool in_use;                        /* In use or free? */
 };
 
+/* Directory entry cache.
+ *
+ * Maps (directory inode sector, name) to the sector of the named
+ * file's inode, so that repeated lookups of the same name do not
+ * have to scan the directory.  Misses are cached too ("negative"
+ * entries), so probing for a file that does not exist is just as
+ * cheap as finding one that does.  dir_add() and dir_remove()
+ * keep the cache in sync with the on-disk directory.  The cache
+ * holds at most DCACHE_MAX entries and evicts the least recently
+ * used one when full. */
+#define DCACHE_MAX 256
+
+struct dcache_entry {
+	struct hash_elem hash_elem;         /* Element in dcache. */
+	struct list_elem lru_elem;          /* Element in dcache_lru. */
+	disk_sector_t dir_sector;           /* Inode sector of directory. */
+	char name[NAME_MAX + 1];            /* Null terminated file name. */
+	bool negative;                      /* True if NAME does not exist. */
+	disk_sector_t inode_sector;         /* Inode sector if !NEGATIVE. */
+};
+
+static struct hash dcache;              /* All cached entries. */
+static struct list dcache_lru;          /* Most recently used first. */
+static struct lock dcache_lock;         /* Protects dcache, dcache_lru. */
+
+static struct kmem_cache *dir_cache;    /* Cache of struct dir. */
+
+static uint64_t dcache_hash (const struct hash_elem *, void *);
+static bool dcache_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+static struct dcache_entry *dcache_find (disk_sector_t, const char *);
+static void dcache_store (disk_sector_t, const char *, bool, disk_sector_t,
+		bool);
+static void dcache_purge_dir (disk_sector_t);
+
+/* Initializes the directory module and its entry cache. */
+void
+dir_init (void) {
+	dir_cache = kmem_cache_create ("dir", sizeof (struct dir), NULL);
+	if (dir_cache == NULL)
+		PANIC ("dir_init: out of memory");
+	hash_init (&dcache, dcache_hash, dcache_less, NULL);
+	list_init (&dcache_lru);
+	lock_init (&dcache_lock);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
  * given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (disk_sector_t sector, size_t entry_cnt) {
-	return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+	return inode_create (sector, entry_cnt * sizeof (struct dir_entry), true);
 }
 
 /* Opens and returns the directory for the given INODE, of which
  * it takes ownership.  Returns a null pointer on failure. */
 struct dir *
 dir_open (struct inode *inode) {
-	struct dir *dir = calloc (1, sizeof *dir);
+	struct dir *dir = kmem_cache_alloc (dir_cache);
 	if (inode != NULL && dir != NULL) {
 		dir->inode = inode;
 		dir->pos = 0;
 		return dir;
 	} else {
 		inode_close (inode);
-		free (dir);
+		kmem_cache_free (dir_cache, dir);
 		return NULL;
 	}
 }
@@ -61,7 +110,7 @@ void
 dir_close (struct dir *dir) {
 	if (dir != NULL) {
 		inode_close (dir->inode);
-		free (dir);
+		kmem_cache_free (dir_cache, dir);
 	}
 }
 
@@ -104,15 +153,35 @@ lookup (const struct dir *dir, const char *name,
 bool
 dir_lookup (const struct dir *dir, const char *name,
 		struct inode **inode) {
+	disk_sector_t dir_sector;
+	struct dcache_entry *ce;
 	struct dir_entry e;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	if (lookup (dir, name, &e, NULL))
+	/* Try the cache first. */
+	dir_sector = inode_get_inumber (dir->inode);
+	lock_acquire (&dcache_lock);
+	ce = dcache_find (dir_sector, name);
+	if (ce != NULL) {
+		bool negative = ce->negative;
+		e.inode_sector = ce->inode_sector;
+		lock_release (&dcache_lock);
+
+		*inode = negative ? NULL : inode_open (e.inode_sector);
+		return *inode != NULL;
+	}
+	lock_release (&dcache_lock);
+
+	/* Cache miss: scan the directory and remember the outcome. */
+	if (lookup (dir, name, &e, NULL)) {
+		dcache_store (dir_sector, name, false, e.inode_sector, false);
 		*inode = inode_open (e.inode_sector);
-	else
+	} else {
+		dcache_store (dir_sector, name, true, 0, false);
 		*inode = NULL;
+	}
 
 	return *inode != NULL;
 }
@@ -136,8 +205,13 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	if (*name == '\0' || strlen (name) > NAME_MAX)
 		return false;
 
-	/* Check that NAME is not in use. */
-	if (lookup (dir, name, NULL, NULL))
+	/* Check that NAME is not in use.  A positive cache entry
+	 * answers that without a scan. */
+	lock_acquire (&dcache_lock);
+	struct dcache_entry *ce = dcache_find (inode_get_inumber (dir->inode), name);
+	bool cached_in_use = ce != NULL && !ce->negative;
+	lock_release (&dcache_lock);
+	if (cached_in_use || lookup (dir, name, NULL, NULL))
 		goto done;
 
 	/* Set OFS to offset of free slot.
@@ -157,6 +231,9 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	strlcpy (e.name, name, sizeof e.name);
 	e.inode_sector = inode_sector;
 	success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+	if (success)
+		dcache_store (inode_get_inumber (dir->inode), name, false,
+				inode_sector, true);
 
 done:
 	return success;
@@ -189,7 +266,10 @@ dir_remove (struct dir *dir, const char *name) {
 	if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
 		goto done;
 
-	/* Remove inode. */
+	/* Remove inode.  Its sector may be recycled for a new
+	 * directory, so forget anything cached under it as well. */
+	dcache_store (inode_get_inumber (dir->inode), name, true, 0, true);
+	dcache_purge_dir (e.inode_sector);
 	inode_remove (inode);
 	success = true;
 
@@ -214,3 +294,112 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1]) {
 	}
 	return false;
 }
+
+/* Returns a hash value for dcache entry E. */
+static uint64_t
+dcache_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct dcache_entry *ce = hash_entry (e, struct dcache_entry,
+			hash_elem);
+	return hash_string (ce->name) ^ hash_int (ce->dir_sector);
+}
+
+/* Returns true if dcache entry A precedes dcache entry B. */
+static bool
+dcache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct dcache_entry *a = hash_entry (a_, struct dcache_entry,
+			hash_elem);
+	const struct dcache_entry *b = hash_entry (b_, struct dcache_entry,
+			hash_elem);
+	if (a->dir_sector != b->dir_sector)
+		return a->dir_sector < b->dir_sector;
+	return strcmp (a->name, b->name) < 0;
+}
+
+/* Returns the cache entry for NAME in the directory whose inode is
+ * at DIR_SECTOR and marks it most recently used, or a null pointer
+ * if there is none.  The caller must hold dcache_lock. */
+static struct dcache_entry *
+dcache_find (disk_sector_t dir_sector, const char *name) {
+	struct dcache_entry key;
+	struct hash_elem *e;
+
+	ASSERT (lock_held_by_current_thread (&dcache_lock));
+
+	if (strlen (name) > NAME_MAX)
+		return NULL;
+	key.dir_sector = dir_sector;
+	strlcpy (key.name, name, sizeof key.name);
+	e = hash_find (&dcache, &key.hash_elem);
+	if (e == NULL)
+		return NULL;
+
+	struct dcache_entry *ce = hash_entry (e, struct dcache_entry, hash_elem);
+	list_remove (&ce->lru_elem);
+	list_push_front (&dcache_lru, &ce->lru_elem);
+	return ce;
+}
+
+/* Records that NAME in the directory whose inode is at DIR_SECTOR
+ * does not exist, if NEGATIVE is true, or that its inode is at
+ * INODE_SECTOR otherwise.  An existing entry for NAME is replaced
+ * only if REPLACE is true, so that the result of a slow directory
+ * scan cannot clobber a concurrent dir_add() or dir_remove().
+ * Failing to allocate an entry is harmless: the next lookup just
+ * misses. */
+static void
+dcache_store (disk_sector_t dir_sector, const char *name, bool negative,
+		disk_sector_t inode_sector, bool replace) {
+	struct dcache_entry *ce;
+
+	if (strlen (name) > NAME_MAX)
+		return;
+
+	lock_acquire (&dcache_lock);
+	ce = dcache_find (dir_sector, name);
+	if (ce != NULL && !replace) {
+		lock_release (&dcache_lock);
+		return;
+	}
+	if (ce == NULL) {
+		if (hash_size (&dcache) >= DCACHE_MAX) {
+			/* Recycle the least recently used entry. */
+			ce = list_entry (list_pop_back (&dcache_lru),
+					struct dcache_entry, lru_elem);
+			hash_delete (&dcache, &ce->hash_elem);
+		} else {
+			ce = malloc (sizeof *ce);
+			if (ce == NULL) {
+				lock_release (&dcache_lock);
+				return;
+			}
+		}
+		ce->dir_sector = dir_sector;
+		strlcpy (ce->name, name, sizeof ce->name);
+		hash_insert (&dcache, &ce->hash_elem);
+		list_push_front (&dcache_lru, &ce->lru_elem);
+	}
+	ce->negative = negative;
+	ce->inode_sector = inode_sector;
+	lock_release (&dcache_lock);
+}
+
+/* Drops every cache entry that belongs to the directory whose inode
+ * is at DIR_SECTOR. */
+static void
+dcache_purge_dir (disk_sector_t dir_sector) {
+	struct list_elem *e;
+
+	lock_acquire (&dcache_lock);
+	for (e = list_begin (&dcache_lru); e != list_end (&dcache_lru);) {
+		struct dcache_entry *ce = list_entry (e, struct dcache_entry,
+				lru_elem);
+		e = list_next (e);
+		if (ce->dir_sector == dir_sector) {
+			list_remove (&ce->lru_elem);
+			hash_delete (&dcache, &ce->hash_elem);
+			free (ce);
+		}
+	}
+	lock_release (&dcache_lock);
+}
@@ -1,29 +1,63 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include <round.h>
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/vaddr.h"
 
 /* An open file. */
 struct file {
 	struct inode *inode;        /* File's inode. */
 	off_t pos;                  /* Current position. */
 	bool deny_write;            /* Has file_deny_write() been called? */
+
+	/* Read-ahead state. */
+	off_t ra_next;              /* Where a sequential read starts. */
+	off_t ra_end;               /* End of the pages read ahead. */
+	size_t ra_pages;            /* Window, in pages, or 0 if off. */
 };
 
+/* Read-ahead.
+ *
+ * A file read sequentially, each file_read() starting where the last
+ * one ended, has the pages after the data read brought into the
+ * page cache in the background, to be there when the reader gets to
+ * them.  The window starts at RA_MIN_PAGES pages and doubles every
+ * time a new one is requested, up to RA_MAX_PAGES, which happens when
+ * the reader gets within half a window of the end of the last one,
+ * so that the disk is kept busy ahead of it.  A read anywhere else
+ * turns read-ahead off until reads are sequential again. */
+#define RA_MIN_PAGES 2
+#define RA_MAX_PAGES 16
+
+/* Cache of struct file. */
+static struct kmem_cache *file_cache;
+
+/* Initializes the file module. */
+void
+file_init (void) {
+	file_cache = kmem_cache_create ("file", sizeof (struct file), NULL);
+	if (file_cache == NULL)
+		PANIC ("file_init: out of memory");
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
  * and returns the new file.  Returns a null pointer if an
  * allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) {
-	struct file *file = calloc (1, sizeof *file);
+	struct file *file = kmem_cache_alloc (file_cache);
 	if (inode != NULL && file != NULL) {
 		file->inode = inode;
 		file->pos = 0;
 		file->deny_write = false;
+		file->ra_next = 0;
+		file->ra_end = 0;
+		file->ra_pages = 0;
 		return file;
 	} else {
 		inode_close (inode);
-		free (file);
+		kmem_cache_free (file_cache, file);
 		return NULL;
 	}
 }
@@ -42,6 +76,7 @@ file_duplicate (struct file *file) {
 	struct file *nfile = file_open (inode_reopen (file->inode));
 	if (nfile) {
 		nfile->pos = file->pos;
+		nfile->ra_next = file->pos;
 		if (file->deny_write)
 			file_deny_write (nfile);
 	}
@@ -54,7 +89,7 @@ file_close (struct file *file) {
 	if (file != NULL) {
 		file_allow_write (file);
 		inode_close (file->inode);
-		free (file);
+		kmem_cache_free (file_cache, file);
 	}
 }
 
@@ -64,6 +99,39 @@ file_get_inode (struct file *file) {
 	return file->inode;
 }
 
+/* Updates FILE's read-ahead state for a read of SIZE bytes at OFS,
+ * just done, and reads ahead if it is sequential. */
+static void
+file_readahead (struct file *file, off_t ofs, off_t size) {
+	off_t end = ofs + size;
+	off_t length, start, window_end;
+
+	if (ofs != file->ra_next) {
+		file->ra_pages = 0;
+		file->ra_end = 0;
+		file->ra_next = end;
+		return;
+	}
+	file->ra_next = end;
+	if (size == 0 || (file->ra_pages > 0
+				&& file->ra_end - end > (off_t) file->ra_pages * PGSIZE / 2))
+		return;
+
+	file->ra_pages = file->ra_pages == 0 ? RA_MIN_PAGES
+		: file->ra_pages * 2 < RA_MAX_PAGES ? file->ra_pages * 2 : RA_MAX_PAGES;
+	length = ROUND_UP (inode_length (file->inode), PGSIZE);
+	start = ROUND_UP (end, PGSIZE);
+	if (start < file->ra_end)
+		start = file->ra_end;
+	window_end = ROUND_UP (end, PGSIZE) + (off_t) file->ra_pages * PGSIZE;
+	if (window_end > length)
+		window_end = length;
+	if (window_end > start) {
+		inode_readahead (file->inode, start, (window_end - start) / PGSIZE);
+		file->ra_end = window_end;
+	}
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
  * starting at the file's current position.
  * Returns the number of bytes actually read,
@@ -72,6 +140,7 @@ file_get_inode (struct file *file) {
 off_t
 file_read (struct file *file, void *buffer, off_t size) {
 	off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+	file_readahead (file, file->pos, bytes_read);
 	file->pos += bytes_read;
 	return bytes_read;
 }
@@ -6,6 +6,8 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
+#include "filesys/page_cache.h"
 #include "devices/disk.h"
 
 /* The disk that contains the file system. */
@@ -22,6 +24,9 @@ filesys_init (bool format) {
 		PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
 	inode_init ();
+	file_init ();
+	dir_init ();
+	pagecache_init ();
 
 #ifdef EFILESYS
 	fat_init ();
@@ -33,6 +38,7 @@ filesys_init (bool format) {
 #else
 	/* Original FS */
 	free_map_init ();
+	journal_init (format);
 
 	if (format)
 		do_format ();
@@ -45,11 +51,15 @@ filesys_init (bool format) {
  * to disk. */
 void
 filesys_done (void) {
+	page_cache_flush_all ();
+	inode_done ();
+
 	/* Original FS */
 #ifdef EFILESYS
 	fat_close ();
 #else
 	free_map_close ();
+	journal_done ();
 #endif
 }
 
@@ -60,14 +70,29 @@ filesys_done (void) {
 bool
 filesys_create (const char *name, off_t initial_size) {
 	disk_sector_t inode_sector = 0;
-	struct dir *dir = dir_open_root ();
-	bool success = (dir != NULL
-			&& free_map_allocate (1, &inode_sector)
-			&& inode_create (inode_sector, initial_size)
+	struct inode *inode = NULL;
+	struct dir *dir;
+	bool created = false;
+	bool success;
+
+	journal_begin ();
+	dir = dir_open_root ();
+	success = (dir != NULL
+			&& free_map_allocate_near (1,
+				inode_get_inumber (dir_get_inode (dir)), &inode_sector)
+			&& (created = inode_create (inode_sector, initial_size, false))
 			&& dir_add (dir, name, inode_sector));
-	if (!success && inode_sector != 0)
+	if (!success && created)
+		inode = inode_open (inode_sector);
+	if (inode != NULL) {
+		/* Removing the new inode also cancels the reservation of its
+		 * data sectors. */
+		inode_remove (inode);
+		inode_close (inode);
+	} else if (!success && inode_sector != 0)
 		free_map_release (inode_sector, 1);
 	dir_close (dir);
+	journal_end ();
 
 	return success;
 }
@@ -95,9 +120,14 @@ filesys_open (const char *name) {
  * or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) {
-	struct dir *dir = dir_open_root ();
-	bool success = dir != NULL && dir_remove (dir, name);
+	struct dir *dir;
+	bool success;
+
+	journal_begin ();
+	dir = dir_open_root ();
+	success = dir != NULL && dir_remove (dir, name);
 	dir_close (dir);
+	journal_end ();
 
 	return success;
 }
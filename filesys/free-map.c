@@ -1,21 +1,68 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
+/* Each allocation or release writes back only the sectors of the
+ * free map file that it changed.  Those writes land in the running
+ * journal transaction, so a burst of allocations costs one disk
+ * write per changed sector when the transaction commits. */
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
+static struct lock free_map_lock;    /* Protects the maps, group_free. */
+
+/* Sectors that may not be allocated: those in use in free_map, and
+ * also those freed by a journal transaction that has not committed
+ * yet, which committed metadata on disk may still point to.  They
+ * come back from journal_pop_freed() after the commit. */
+static struct bitmap *busy_map;
+
+/* Allocation groups.
+ *
+ * The disk is divided into groups of FREE_MAP_GROUP_SECTORS
+ * consecutive sectors, each with its own count of free sectors.
+ * free_map_allocate_near() looks for space in the group of its
+ * hint sector first, then in the groups closest to it, skipping
+ * any group without enough free sectors, so that an inode lands
+ * near its directory and a file's data near its inode.  Only runs
+ * that fit in no single group are searched for across the whole
+ * disk.  The on-disk free map stays a single bitmap; each group's
+ * part of busy_map serves as that group's bitmap. */
+#define FREE_MAP_GROUP_SECTORS 4096
+
+static size_t group_cnt;             /* Number of groups. */
+static size_t *group_free;           /* Free sectors in each group. */
+
+static void count_group_free (void);
+static void reclaim_freed (void);
+static disk_sector_t find_run (size_t cnt, disk_sector_t hint);
+static void sync_busy_map (void);
+static void account_run (disk_sector_t, size_t cnt, bool allocated);
+static disk_sector_t scan_group (size_t group, size_t cnt);
 
 /* Initializes the free map. */
 void
 free_map_init (void) {
+	lock_init (&free_map_lock);
 	free_map = bitmap_create (disk_size (filesys_disk));
-	if (free_map == NULL)
+	busy_map = bitmap_create (disk_size (filesys_disk));
+	if (free_map == NULL || busy_map == NULL)
 		PANIC ("bitmap creation failed--disk is too large");
 	bitmap_mark (free_map, FREE_MAP_SECTOR);
 	bitmap_mark (free_map, ROOT_DIR_SECTOR);
+	bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+
+	group_cnt = DIV_ROUND_UP (bitmap_size (free_map), FREE_MAP_GROUP_SECTORS);
+	group_free = malloc (group_cnt * sizeof *group_free);
+	if (group_free == NULL)
+		PANIC ("allocation group creation failed");
+	sync_busy_map ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -24,24 +71,161 @@ free_map_init (void) {
  * available. */
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
-	disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-	if (sector != BITMAP_ERROR
-			&& free_map_file != NULL
-			&& !bitmap_write (free_map, free_map_file)) {
-		bitmap_set_multiple (free_map, sector, cnt, false);
-		sector = BITMAP_ERROR;
+	return free_map_allocate_near (cnt, 0, sectorp);
+}
+
+/* Allocates CNT consecutive sectors from the free map, preferring
+ * the allocation group of sector HINT and then the groups nearest
+ * it, and stores the first into *SECTORP.
+ * Returns true if successful, false if all sectors were
+ * available. */
+bool
+free_map_allocate_near (size_t cnt, disk_sector_t hint,
+		disk_sector_t *sectorp) {
+	disk_sector_t sector;
+
+	journal_begin ();
+	lock_acquire (&free_map_lock);
+	sector = find_run (cnt, hint);
+	if (sector != BITMAP_ERROR) {
+		bitmap_set_multiple (free_map, sector, cnt, true);
+		bitmap_set_multiple (busy_map, sector, cnt, true);
+		account_run (sector, cnt, true);
+		if (free_map_file != NULL
+				&& !bitmap_write_dirty (free_map, free_map_file)) {
+			bitmap_set_multiple (free_map, sector, cnt, false);
+			bitmap_set_multiple (busy_map, sector, cnt, false);
+			account_run (sector, cnt, false);
+			sector = BITMAP_ERROR;
+		}
 	}
+	lock_release (&free_map_lock);
+	journal_end ();
 	if (sector != BITMAP_ERROR)
 		*sectorp = sector;
 	return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Reserves CNT consecutive sectors, chosen as by
+ * free_map_allocate_near(), and stores the first into *SECTORP.
+ * Reserved sectors are not given out again, but stay free on disk
+ * until free_map_commit() allocates them, so reserving costs no disk
+ * write, and a reservation does not outlive a crash.
+ * Returns true if successful, false if no such run is free. */
+bool
+free_map_reserve (size_t cnt, disk_sector_t hint, disk_sector_t *sectorp) {
+	disk_sector_t sector;
+
+	lock_acquire (&free_map_lock);
+	sector = find_run (cnt, hint);
+	if (sector != BITMAP_ERROR) {
+		bitmap_set_multiple (busy_map, sector, cnt, true);
+		account_run (sector, cnt, true);
+		*sectorp = sector;
+	}
+	lock_release (&free_map_lock);
+	return sector != BITMAP_ERROR;
+}
+
+/* Allocates on disk the CNT sectors starting at SECTOR, which
+ * free_map_reserve() reserved. */
+void
+free_map_commit (disk_sector_t sector, size_t cnt) {
+	journal_begin ();
+	lock_acquire (&free_map_lock);
+	ASSERT (bitmap_all (busy_map, sector, cnt));
+	ASSERT (bitmap_none (free_map, sector, cnt));
+	bitmap_set_multiple (free_map, sector, cnt, true);
+	bitmap_write_dirty (free_map, free_map_file);
+	lock_release (&free_map_lock);
+	journal_end ();
+}
+
+/* Cancels the reservation of the CNT sectors starting at SECTOR,
+ * which free_map_reserve() reserved and nothing on disk refers to,
+ * so they are available again at once. */
+void
+free_map_unreserve (disk_sector_t sector, size_t cnt) {
+	lock_acquire (&free_map_lock);
+	ASSERT (bitmap_all (busy_map, sector, cnt));
+	ASSERT (bitmap_none (free_map, sector, cnt));
+	bitmap_set_multiple (busy_map, sector, cnt, false);
+	account_run (sector, cnt, false);
+	lock_release (&free_map_lock);
+}
+
+/* Makes CNT sectors starting at SECTOR available for use, once the
+ * running journal transaction commits. */
 void
 free_map_release (disk_sector_t sector, size_t cnt) {
+	journal_begin ();
+	journal_forget (sector, cnt);
+
+	lock_acquire (&free_map_lock);
 	ASSERT (bitmap_all (free_map, sector, cnt));
 	bitmap_set_multiple (free_map, sector, cnt, false);
-	bitmap_write (free_map, free_map_file);
+	bitmap_write_dirty (free_map, free_map_file);
+	if (!journal_defer_free (sector, cnt)) {
+		bitmap_set_multiple (busy_map, sector, cnt, false);
+		account_run (sector, cnt, false);
+	}
+	lock_release (&free_map_lock);
+	journal_end ();
+}
+
+/* Returns the first of CNT consecutive sectors that may be
+ * allocated, looking in the allocation group of sector HINT first
+ * and then in the groups nearest it, or BITMAP_ERROR if there are
+ * none.  The caller must hold free_map_lock. */
+static disk_sector_t
+find_run (size_t cnt, disk_sector_t hint) {
+	disk_sector_t sector = BITMAP_ERROR;
+	size_t home = hint / FREE_MAP_GROUP_SECTORS;
+	size_t d;
+
+	ASSERT (lock_held_by_current_thread (&free_map_lock));
+
+	if (home >= group_cnt)
+		home = 0;
+
+	reclaim_freed ();
+	if (cnt <= FREE_MAP_GROUP_SECTORS)
+		for (d = 0; d < group_cnt && sector == BITMAP_ERROR; d++) {
+			if (home + d < group_cnt)
+				sector = scan_group (home + d, cnt);
+			if (sector == BITMAP_ERROR && d > 0 && d <= home)
+				sector = scan_group (home - d, cnt);
+		}
+	if (sector == BITMAP_ERROR)
+		sector = bitmap_scan (busy_map, 0, cnt, false);
+	return sector;
+}
+
+/* Makes the sectors freed by committed transactions available for
+ * allocation.  The caller must hold free_map_lock. */
+static void
+reclaim_freed (void) {
+	disk_sector_t sector;
+	size_t cnt;
+
+	ASSERT (lock_held_by_current_thread (&free_map_lock));
+
+	while (journal_pop_freed (&sector, &cnt)) {
+		ASSERT (bitmap_all (busy_map, sector, cnt));
+		bitmap_set_multiple (busy_map, sector, cnt, false);
+		account_run (sector, cnt, false);
+	}
+}
+
+/* Makes busy_map a copy of free_map and recomputes the group
+ * counts from it. */
+static void
+sync_busy_map (void) {
+	size_t i;
+
+	for (i = 0; i < bitmap_size (free_map); i++)
+		bitmap_set (busy_map, i, bitmap_test (free_map, i));
+	count_group_free ();
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -52,6 +236,7 @@ free_map_open (void) {
 		PANIC ("can't open free map");
 	if (!bitmap_read (free_map, free_map_file))
 		PANIC ("can't read free map");
+	sync_busy_map ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -65,7 +250,7 @@ free_map_close (void) {
 void
 free_map_create (void) {
 	/* Create inode. */
-	if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+	if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), true))
 		PANIC ("free map creation failed");
 
 	/* Write bitmap to file. */
@@ -75,3 +260,57 @@ free_map_create (void) {
 	if (!bitmap_write (free_map, free_map_file))
 		PANIC ("can't write free map");
 }
+
+/* Recomputes the number of free sectors in every group from the
+ * free map. */
+static void
+count_group_free (void) {
+	size_t g;
+
+	for (g = 0; g < group_cnt; g++) {
+		size_t start = g * FREE_MAP_GROUP_SECTORS;
+		size_t cnt = bitmap_size (free_map) - start;
+		if (cnt > FREE_MAP_GROUP_SECTORS)
+			cnt = FREE_MAP_GROUP_SECTORS;
+		group_free[g] = bitmap_count (busy_map, start, cnt, false);
+	}
+}
+
+/* Updates the free counts of the groups that the CNT sectors
+ * starting at SECTOR belong to, which were just ALLOCATED or, if
+ * false, released. */
+static void
+account_run (disk_sector_t sector, size_t cnt, bool allocated) {
+	while (cnt > 0) {
+		size_t g = sector / FREE_MAP_GROUP_SECTORS;
+		size_t n = (g + 1) * FREE_MAP_GROUP_SECTORS - sector;
+		if (n > cnt)
+			n = cnt;
+		if (allocated)
+			group_free[g] -= n;
+		else
+			group_free[g] += n;
+		sector += n;
+		cnt -= n;
+	}
+}
+
+/* Returns the first of CNT consecutive free sectors within GROUP,
+ * or BITMAP_ERROR if there are none. */
+static disk_sector_t
+scan_group (size_t group, size_t cnt) {
+	size_t start = group * FREE_MAP_GROUP_SECTORS;
+	size_t end = start + FREE_MAP_GROUP_SECTORS;
+	size_t sector;
+
+	if (group_free[group] < cnt)
+		return BITMAP_ERROR;
+	if (end > bitmap_size (busy_map))
+		end = bitmap_size (busy_map);
+
+	/* The first free run at or after START ends within the group
+	 * if any run within the group does. */
+	sector = bitmap_scan (busy_map, start, cnt, false);
+	return sector != BITMAP_ERROR && sector + cnt <= end ? sector
+		: BITMAP_ERROR;
+}
@@ -1,11 +1,18 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "filesys/page_cache.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/vaddr.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
@@ -13,10 +20,15 @@
 /* On-disk inode.
  * Must be exactly DISK_SECTOR_SIZE bytes long. */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
+	disk_sector_t start;                /* First data sector, or 0 if
+	                                       unallocated. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
-	uint32_t unused[125];               /* Not used. */
+	uint32_t unallocated;               /* Nonzero until data sectors
+	                                       are assigned. */
+	off_t valid;                        /* Bytes initialized on disk. */
+	uint32_t metadata;                  /* Nonzero if data is journaled. */
+	uint32_t unused[122];               /* Not used. */
 };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -26,16 +38,69 @@ bytes_to_sectors (off_t size) {
 	return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
 }
 
+/* Key of an in-memory inode in the inode table, kept small so
+ * that a lookup key fits on the stack. */
+struct inode_key {
+	struct hash_elem elem;              /* Element in inode table. */
+	disk_sector_t sector;               /* Sector number of disk location. */
+};
+
 /* In-memory inode. */
 struct inode {
-	struct list_elem elem;              /* Element in inode list. */
-	disk_sector_t sector;               /* Sector number of disk location. */
+	struct inode_key key;               /* Table element and sector. */
+	struct list_elem lru_elem;          /* Element in inode_lru if closed. */
 	int open_cnt;                       /* Number of openers. */
 	bool removed;                       /* True if deleted, false otherwise. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
-	struct inode_disk data;             /* Inode content. */
+	struct lock lock;                   /* Protects allocation, `valid'. */
+	bool dirty;                         /* DATA changed since last write. */
+	struct inode_disk data;             /* Inode content, but `start' is
+	                                       the reserved run, if any, while
+	                                       unallocated. */
 };
 
+/* Delayed allocation.
+ *
+ * A newly created inode gets no data sectors on disk: its disk
+ * inode is marked `unallocated' and reads of it return zeros.  Its
+ * data goes through the page cache like any other file's, and only
+ * when the cache writes back the first dirty page does the inode
+ * get its sectors: the free map and the disk inode are updated in
+ * one transaction, and the inode is marked allocated.  A file that
+ * is removed before then never touches the disk for its data at
+ * all.
+ *
+ * So that a dirty page always has somewhere to go, the in-memory
+ * inode holds a reservation of one contiguous run of sectors for
+ * the whole file, near the inode, which keeps others from taking
+ * them but is not recorded on disk.  inode_create() makes it, so
+ * that creating a file the disk has no room for fails, and keeps
+ * the new inode in the table of closed inodes to hold it.  An inode
+ * that is opened again after dropping out of the table, or after a
+ * reboot, reserves its run again on the first write, or when it is
+ * mapped writable, which fails if the disk is full, before any data
+ * is accepted.
+ *
+ * Metadata inodes, whose data goes through the journal, are
+ * allocated up front.
+ *
+ * Allocation does not zero the new sectors either.  Instead, the
+ * disk inode's `valid' records how many bytes at the start of the
+ * file have been initialized on disk; the rest reads as zeros, and
+ * a write beyond it zeros only the sectors it skips over.  A file
+ * written sequentially is thus written exactly once.  Any sector
+ * that holds the byte at `valid' is zero from there on. */
+
+/* A page of zeros, for initializing sectors. */
+static uint8_t zeros[PGSIZE];
+
+static void inode_allocate (struct inode *);
+static void inode_unreserve (struct inode *);
+static void inode_flush (struct inode *);
+static void zero_gap (struct inode *, off_t);
+static off_t write_at (struct inode *, const uint8_t *, off_t size,
+		off_t offset);
+
 /* Returns the disk sector that contains byte offset POS within
  * INODE.
  * Returns -1 if INODE does not contain data for a byte at offset
@@ -43,30 +108,71 @@ struct inode {
 static disk_sector_t
 byte_to_sector (const struct inode *inode, off_t pos) {
 	ASSERT (inode != NULL);
+	ASSERT (!inode->data.unallocated);
 	if (pos < inode->data.length)
 		return inode->data.start + pos / DISK_SECTOR_SIZE;
 	else
 		return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
- * returns the same `struct inode'. */
-static struct list open_inodes;
+/* Table of in-memory inodes, keyed by sector, so that opening a
+ * single inode twice returns the same `struct inode'.
+ *
+ * Besides the open inodes, the table also retains up to
+ * INODE_CACHE_MAX inodes that nobody has open any more, together
+ * with their `inode_disk', so that reopening a recently closed
+ * file does not have to read its inode back from disk.  Those
+ * closed inodes are also on inode_lru, least recently closed
+ * last, and are dropped from the back when the cache is full. */
+#define INODE_CACHE_MAX 64
+
+static struct hash inode_table;
+static struct list inode_lru;
+static struct lock inode_table_lock;    /* Protects the above. */
+
+/* Cache of struct inode.  A free inode has its lock released, as
+ * inode_ctor() leaves it. */
+static struct kmem_cache *inode_cache;
+
+static void inode_ctor (void *);
+static uint64_t inode_hash (const struct hash_elem *, void *);
+static bool inode_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+static struct inode *inode_lookup (disk_sector_t);
+static void inode_cache_closed (struct inode *);
+static void inode_drop (struct inode *);
+
+/* Sets up the parts of a new struct inode that are in the same
+ * state whenever it is free. */
+static void
+inode_ctor (void *inode_) {
+	struct inode *inode = inode_;
+
+	lock_init (&inode->lock);
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
-	list_init (&open_inodes);
+	inode_cache = kmem_cache_create ("inode", sizeof (struct inode),
+			inode_ctor);
+	if (inode_cache == NULL)
+		PANIC ("inode_init: out of memory");
+	hash_init (&inode_table, inode_hash, inode_less, NULL);
+	list_init (&inode_lru);
+	lock_init (&inode_table_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
  * writes the new inode to sector SECTOR on the file system
- * disk.
+ * disk.  If METADATA is true, the inode holds file system
+ * metadata, such as a directory, whose writes are journaled.
  * Returns true if successful.
  * Returns false if memory or disk allocation fails. */
 bool
-inode_create (disk_sector_t sector, off_t length) {
+inode_create (disk_sector_t sector, off_t length, bool metadata) {
 	struct inode_disk *disk_inode = NULL;
+	struct inode *inode;
 	bool success = false;
 
 	ASSERT (length >= 0);
@@ -75,20 +181,62 @@ inode_create (disk_sector_t sector, off_t length) {
 	 * one sector in size, and you should fix that. */
 	ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
 
+	/* Forget any closed inode cached for SECTOR: its contents are
+	 * about to be replaced. */
+	lock_acquire (&inode_table_lock);
+	struct inode *cached = inode_lookup (sector);
+	if (cached != NULL && cached->open_cnt == 0) {
+		list_remove (&cached->lru_elem);
+		inode_drop (cached);
+	}
+	lock_release (&inode_table_lock);
+
 	disk_inode = calloc (1, sizeof *disk_inode);
 	if (disk_inode != NULL) {
 		size_t sectors = bytes_to_sectors (length);
 		disk_inode->length = length;
 		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
+
+		disk_inode->metadata = metadata;
+
+		/* Defer allocating data sectors until they are written back,
+		 * but reserve them now, in a closed in-memory inode kept in
+		 * the table; see above.  Metadata is instead zeroed through
+		 * the journal up front. */
+		if (sectors > 0 && !metadata) {
+			inode = kmem_cache_alloc (inode_cache);
+			if (inode != NULL && free_map_reserve (sectors, sector,
+						&inode->data.start)) {
+				disk_inode->unallocated = 1;
+				journal_write (sector, disk_inode);
+
+				inode->key.sector = sector;
+				inode->open_cnt = 0;
+				inode->deny_write_cnt = 0;
+				inode->removed = false;
+				inode->dirty = false;
+				disk_inode->start = inode->data.start;
+				inode->data = *disk_inode;
+
+				lock_acquire (&inode_table_lock);
+				if (hash_insert (&inode_table, &inode->key.elem) == NULL)
+					inode_cache_closed (inode);
+				else {
+					inode_unreserve (inode);
+					kmem_cache_free (inode_cache, inode);
+				}
+				lock_release (&inode_table_lock);
+				success = true;
+			} else if (inode != NULL)
+				kmem_cache_free (inode_cache, inode);
+		} else if (free_map_allocate_near (sectors, sector,
+					&disk_inode->start)) {
+			size_t i;
+
+			disk_inode->valid = length;
+			journal_write (sector, disk_inode);
+			for (i = 0; i < sectors; i++)
+				journal_write (disk_inode->start + i, zeros);
 			success = true; 
 		} 
 		free (disk_inode);
@@ -101,71 +249,151 @@ inode_create (disk_sector_t sector, off_t length) {
  * Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (disk_sector_t sector) {
-	struct list_elem *e;
-	struct inode *inode;
-
-	/* Check whether this inode is already open. */
-	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-			e = list_next (e)) {
-		inode = list_entry (e, struct inode, elem);
-		if (inode->sector == sector) {
-			inode_reopen (inode);
-			return inode; 
-		}
+	struct inode *inode, *other;
+
+	/* Check whether this inode is already open or cached. */
+	lock_acquire (&inode_table_lock);
+	inode = inode_lookup (sector);
+	if (inode != NULL) {
+		if (inode->open_cnt++ == 0)
+			list_remove (&inode->lru_elem);
+		lock_release (&inode_table_lock);
+		return inode;
 	}
+	lock_release (&inode_table_lock);
 
 	/* Allocate memory. */
-	inode = malloc (sizeof *inode);
+	inode = kmem_cache_alloc (inode_cache);
 	if (inode == NULL)
 		return NULL;
 
-	/* Initialize. */
-	list_push_front (&open_inodes, &inode->elem);
-	inode->sector = sector;
+	/* Initialize.  Read the disk inode without holding the table
+	 * lock, then recheck in case someone else opened SECTOR in the
+	 * meantime. */
+	inode->key.sector = sector;
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
+	inode->dirty = false;
+	journal_read (inode->key.sector, &inode->data);
+
+	lock_acquire (&inode_table_lock);
+	other = inode_lookup (sector);
+	if (other != NULL) {
+		if (other->open_cnt++ == 0)
+			list_remove (&other->lru_elem);
+		kmem_cache_free (inode_cache, inode);
+		inode = other;
+	} else
+		hash_insert (&inode_table, &inode->key.elem);
+	lock_release (&inode_table_lock);
 	return inode;
 }
 
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode) {
-	if (inode != NULL)
+	if (inode != NULL) {
+		lock_acquire (&inode_table_lock);
 		inode->open_cnt++;
+		lock_release (&inode_table_lock);
+	}
 	return inode;
 }
 
 /* Returns INODE's inode number. */
 disk_sector_t
 inode_get_inumber (const struct inode *inode) {
-	return inode->sector;
+	return inode->key.sector;
 }
 
 /* Closes INODE and writes it to disk.
- * If this was the last reference to INODE, frees its memory.
- * If INODE was also a removed inode, frees its blocks. */
+ * If this was the last reference to INODE, writes back its cached
+ * data and moves it to the cache of closed inodes, or, if INODE was
+ * also a removed inode, frees its memory and its blocks.
+ *
+ * Writing back a page may allocate INODE's sectors, which starts a
+ * journal operation, so the waits for INODE's pages here happen
+ * outside of one: a caller inside a journal operation must not
+ * close the last reference to an inode with dirty pages. */
 void
 inode_close (struct inode *inode) {
 	/* Ignore null pointer. */
 	if (inode == NULL)
 		return;
 
-	/* Release resources if this was the last opener. */
-	if (--inode->open_cnt == 0) {
-		/* Remove from inode list and release lock. */
-		list_remove (&inode->elem);
+	lock_acquire (&inode_table_lock);
+
+	/* The last opener writes back cached data and the disk inode
+	 * first, still holding its reference so that the inode cannot go
+	 * away meanwhile.  The table lock is dropped for the disk writes;
+	 * anyone who opens INODE in the meantime will close it again
+	 * after us. */
+	while (inode->open_cnt == 1 && !inode->removed
+			&& (inode->dirty || page_cache_dirty (inode))) {
+		lock_release (&inode_table_lock);
+		page_cache_flush (inode);
+		journal_begin ();
+		lock_acquire (&inode->lock);
+		inode_flush (inode);
+		lock_release (&inode->lock);
+		journal_end ();
+		lock_acquire (&inode_table_lock);
+	}
 
-		/* Deallocate blocks if removed. */
-		if (inode->removed) {
-			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
-		}
+	if (--inode->open_cnt > 0) {
+		lock_release (&inode_table_lock);
+		return;
+	}
 
-		free (inode); 
+	if (inode->removed) {
+		/* Last opener of a removed inode: remove it from the table,
+		 * drop its cached data, and deallocate its blocks. */
+		hash_delete (&inode_table, &inode->key.elem);
+		lock_release (&inode_table_lock);
+
+		page_cache_discard (inode);
+		journal_begin ();
+		free_map_release (inode->key.sector, 1);
+		if (inode->data.unallocated)
+			inode_unreserve (inode);
+		else
+			free_map_release (inode->data.start,
+					bytes_to_sectors (inode->data.length));
+		journal_end ();
+		kmem_cache_free (inode_cache, inode);
+		return;
 	}
+
+	inode_cache_closed (inode);
+	lock_release (&inode_table_lock);
+}
+
+/* Keeps INODE, which is in the table but no longer open, around for
+ * a later inode_open(), making room by dropping the least recently
+ * closed inode if needed.  The caller must hold inode_table_lock. */
+static void
+inode_cache_closed (struct inode *inode) {
+	ASSERT (lock_held_by_current_thread (&inode_table_lock));
+	ASSERT (inode->open_cnt == 0);
+
+	list_push_front (&inode_lru, &inode->lru_elem);
+	if (list_size (&inode_lru) > INODE_CACHE_MAX)
+		inode_drop (list_entry (list_pop_back (&inode_lru),
+					struct inode, lru_elem));
+}
+
+/* Removes INODE, which is closed and already off inode_lru, from the
+ * table, and frees it together with its cached data and reserved
+ * sectors.  The caller must hold inode_table_lock. */
+static void
+inode_drop (struct inode *inode) {
+	ASSERT (lock_held_by_current_thread (&inode_table_lock));
+
+	hash_delete (&inode_table, &inode->key.elem);
+	page_cache_discard (inode);
+	inode_unreserve (inode);
+	kmem_cache_free (inode_cache, inode);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -176,15 +404,81 @@ inode_remove (struct inode *inode) {
 	inode->removed = true;
 }
 
+/* Returns the number of whole sectors, at most MAX_CNT, that INODE
+ * stores contiguously on disk starting with the sector that holds
+ * byte offset POS, which must be sector-aligned. */
+static size_t
+sector_run (const struct inode *inode, off_t pos, size_t max_cnt) {
+	disk_sector_t first = byte_to_sector (inode, pos);
+	size_t cnt = 1;
+
+	ASSERT (pos % DISK_SECTOR_SIZE == 0);
+
+	if (max_cnt > DISK_MAX_SECTORS_PER_REQ)
+		max_cnt = DISK_MAX_SECTORS_PER_REQ;
+	while (cnt < max_cnt
+			&& byte_to_sector (inode, pos + cnt * DISK_SECTOR_SIZE)
+				== first + cnt)
+		cnt++;
+	return cnt;
+}
+
+/* Returns the running thread's sector-sized bounce buffer for
+ * partial-sector transfers, allocating it on first use, or a null
+ * pointer if memory is not available.  The buffer lives until the
+ * thread exits; see inode_release_bounce(). */
+static uint8_t *
+get_bounce (void) {
+	struct thread *t = thread_current ();
+	if (t->fs_bounce == NULL)
+		t->fs_bounce = malloc (DISK_SECTOR_SIZE);
+	return t->fs_bounce;
+}
+
+/* Frees the running thread's bounce buffer, if any.
+ * Called by thread_exit(). */
+void
+inode_release_bounce (void) {
+	struct thread *t = thread_current ();
+	free (t->fs_bounce);
+	t->fs_bounce = NULL;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
  * Returns the number of bytes actually read, which may be less
- * than SIZE if an error occurs or end of file is reached. */
+ * than SIZE if an error occurs or end of file is reached.
+ * File data comes from the page cache. */
 off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) {
+	if (inode->data.metadata)
+		return inode_read_disk (inode, buffer, size, offset);
+	return page_cache_read (inode, buffer, size, offset);
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position
+ * OFFSET, from the disk or, for metadata, the journal, bypassing the
+ * page cache, which uses this to read pages in.  An unallocated
+ * INODE reads as zeros.
+ * Returns the number of bytes actually read. */
+off_t
+inode_read_disk (struct inode *inode, void *buffer_, off_t size,
+		off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
-	uint8_t *bounce = NULL;
+	off_t valid;
+
+	if (inode->data.unallocated) {
+		/* None of INODE's pages has been written back, so a page that
+		 * the cache reads in has never been written. */
+		off_t inode_left = inode_length (inode) - offset;
+		if (inode_left <= 0)
+			return 0;
+		bytes_read = size < inode_left ? size : inode_left;
+		memset (buffer, 0, bytes_read);
+		return bytes_read;
+	}
 
+	valid = inode->data.valid;
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
 		disk_sector_t sector_idx = byte_to_sector (inode, offset);
@@ -200,17 +494,35 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
+		if (offset - sector_ofs >= valid) {
+			/* Never written: reads as zeros. */
+			memset (buffer + bytes_read, 0, chunk_size);
+		} else if (inode->data.metadata) {
+			/* Metadata may have uncommitted updates in the journal. */
+			uint8_t *bounce = get_bounce ();
+			if (bounce == NULL)
+				break;
+			journal_read (sector_idx, bounce);
+			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+		} else if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
+			/* Read as many whole, contiguous, initialized sectors as
+			 * possible directly into caller's buffer with one
+			 * request. */
+			off_t whole = (size < inode_left ? size : inode_left)
+				/ DISK_SECTOR_SIZE;
+			off_t initialized = DIV_ROUND_UP (valid - offset,
+					DISK_SECTOR_SIZE);
+			size_t cnt = sector_run (inode, offset,
+					whole < initialized ? whole : initialized);
+			disk_read_multiple (filesys_disk, sector_idx, cnt,
+					buffer + bytes_read);
+			chunk_size = cnt * DISK_SECTOR_SIZE;
 		} else {
 			/* Read sector into bounce buffer, then partially copy
 			 * into caller's buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
+			uint8_t *bounce = get_bounce ();
+			if (bounce == NULL)
+				break;
 			disk_read (filesys_disk, sector_idx, bounce);
 			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
 		}
@@ -220,25 +532,73 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
-	free (bounce);
 
 	return bytes_read;
 }
 
+/* Starts reading the CNT pages of INODE from OFS, which must be
+ * page-aligned, into the page cache in the background, if INODE's
+ * data goes through the cache and is on disk. */
+void
+inode_readahead (struct inode *inode, off_t ofs, size_t cnt) {
+	if (!inode->data.unallocated && !inode->data.metadata)
+		page_cache_readahead (inode, ofs, cnt);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
  * Returns the number of bytes actually written, which may be
  * less than SIZE if end of file is reached or an error occurs.
  * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+ * growth is not yet implemented.)  File data goes to the page
+ * cache, once INODE's sectors are reserved. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
 		off_t offset) {
-	const uint8_t *buffer = buffer_;
-	off_t bytes_written = 0;
-	uint8_t *bounce = NULL;
+	off_t bytes_written;
 
 	if (inode->deny_write_cnt)
 		return 0;
+	if (!inode->data.metadata) {
+		if (!inode_reserve (inode))
+			return 0;
+		return page_cache_write (inode, buffer, size, offset);
+	}
+
+	journal_begin ();
+	bytes_written = write_at (inode, buffer, size, offset);
+	journal_end ();
+	return bytes_written;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, which holds file data,
+ * starting at OFFSET, directly to the disk, allocating INODE's
+ * reserved sectors first if it has none yet.  Used by the page cache
+ * to write pages back.  Returns the number of bytes actually
+ * written. */
+off_t
+inode_write_disk (struct inode *inode, const void *buffer, off_t size,
+		off_t offset) {
+	ASSERT (!inode->data.metadata);
+	if (inode->data.unallocated)
+		inode_allocate (inode);
+	return write_at (inode, buffer, size, offset);
+}
+
+/* Does the work for inode_write_at() and inode_write_disk(). */
+static off_t
+write_at (struct inode *inode, const uint8_t *buffer, off_t size,
+		off_t offset) {
+	off_t bytes_written = 0;
+	bool extending;
+
+	/* Writers past the initialized part of INODE serialize on its
+	 * lock, zero any sectors they skip, and advance `valid'. */
+	extending = size > 0 && offset + size > inode->data.valid;
+	if (extending) {
+		lock_acquire (&inode->lock);
+		if (offset < inode_length (inode))
+			zero_gap (inode, offset);
+	}
 
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
@@ -255,38 +615,163 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
+		if (!inode->data.metadata
+				&& sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
+			/* Write as many whole, contiguous sectors as possible
+			 * directly from caller's buffer with one request. */
+			off_t whole = (size < inode_left ? size : inode_left)
+				/ DISK_SECTOR_SIZE;
+			size_t cnt = sector_run (inode, offset, whole);
+			disk_write_multiple (filesys_disk, sector_idx, cnt,
+					buffer + bytes_written);
+			chunk_size = cnt * DISK_SECTOR_SIZE;
 		} else {
 			/* We need a bounce buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
+			uint8_t *bounce = get_bounce ();
+			if (bounce == NULL)
+				break;
 
 			/* If the sector contains data before or after the chunk
 			   we're writing, then we need to read in the sector
-			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
-				disk_read (filesys_disk, sector_idx, bounce);
-			else
+			   first.  Otherwise we start with a sector of all zeros.
+			   Metadata goes through the journal. */
+			if ((sector_ofs > 0 || chunk_size < sector_left)
+					&& offset - sector_ofs < inode->data.valid) {
+				if (inode->data.metadata)
+					journal_read (sector_idx, bounce);
+				else
+					disk_read (filesys_disk, sector_idx, bounce);
+			} else
 				memset (bounce, 0, DISK_SECTOR_SIZE);
 			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-			disk_write (filesys_disk, sector_idx, bounce); 
+			if (inode->data.metadata)
+				journal_write (sector_idx, bounce);
+			else
+				disk_write (filesys_disk, sector_idx, bounce); 
 		}
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_written += chunk_size;
+		if (extending && offset > inode->data.valid) {
+			inode->data.valid = offset;
+			inode->dirty = true;
+		}
 	}
-	free (bounce);
 
+	if (extending)
+		lock_release (&inode->lock);
 	return bytes_written;
 }
 
+/* Reserves the data sectors of INODE, one contiguous run near it,
+ * unless it has them on disk or reserved already.  Returns false if
+ * the disk is full. */
+bool
+inode_reserve (struct inode *inode) {
+	bool success = true;
+
+	if (!inode->data.unallocated)
+		return true;
+
+	lock_acquire (&inode->lock);
+	if (inode->data.unallocated && inode->data.start == 0)
+		success = free_map_reserve (bytes_to_sectors (inode->data.length),
+				inode->key.sector, &inode->data.start);
+	lock_release (&inode->lock);
+	return success;
+}
+
+/* Allocates on disk the sectors reserved for INODE, unless another
+ * writeback did so first, and marks the disk inode allocated, with
+ * nothing initialized yet, in the same transaction.  The caller is
+ * writing back one of INODE's pages, so it must not be inside a
+ * journal operation: the journal might wait for one that waits for
+ * the page.  See inode_close(). */
+static void
+inode_allocate (struct inode *inode) {
+	journal_begin ();
+	lock_acquire (&inode->lock);
+	if (inode->data.unallocated) {
+		ASSERT (inode->data.start != 0);
+		free_map_commit (inode->data.start,
+				bytes_to_sectors (inode->data.length));
+		inode->data.valid = 0;
+		inode->data.unallocated = 0;
+		journal_write (inode->key.sector, &inode->data);
+		inode->dirty = false;
+	}
+	lock_release (&inode->lock);
+	journal_end ();
+}
+
+/* Cancels the reservation of unallocated INODE's sectors, if it has
+ * one.  Nobody else may be using INODE. */
+static void
+inode_unreserve (struct inode *inode) {
+	if (inode->data.unallocated && inode->data.start != 0) {
+		free_map_unreserve (inode->data.start,
+				bytes_to_sectors (inode->data.length));
+		inode->data.start = 0;
+	}
+}
+
+/* Writes INODE's disk inode, if it changed.  The caller must hold
+ * INODE's lock. */
+static void
+inode_flush (struct inode *inode) {
+	ASSERT (lock_held_by_current_thread (&inode->lock));
+
+	if (inode->dirty) {
+		journal_write (inode->key.sector, &inode->data);
+		inode->dirty = false;
+	}
+}
+
+/* Zeros the sectors of allocated INODE that lie wholly between its
+ * initialized part and byte offset OFS, and extends the initialized
+ * part to cover them.  The caller must hold INODE's lock. */
+static void
+zero_gap (struct inode *inode, off_t ofs) {
+	off_t first = DIV_ROUND_UP (inode->data.valid, DISK_SECTOR_SIZE);
+	off_t last = ofs / DISK_SECTOR_SIZE;
+
+	ASSERT (lock_held_by_current_thread (&inode->lock));
+
+	while (first < last) {
+		size_t cnt = last - first;
+		if (cnt > PGSIZE / DISK_SECTOR_SIZE)
+			cnt = PGSIZE / DISK_SECTOR_SIZE;
+		disk_write_multiple (filesys_disk, byte_to_sector (inode,
+					first * DISK_SECTOR_SIZE), cnt, zeros);
+		first += cnt;
+		inode->data.valid = first * DISK_SECTOR_SIZE;
+		inode->dirty = true;
+	}
+}
+
+/* Writes back the disk inode of every inode in the table.
+ * Called at shutdown, when inodes may still be open. */
+void
+inode_done (void) {
+	struct hash_iterator i;
+
+	journal_begin ();
+	lock_acquire (&inode_table_lock);
+	hash_first (&i, &inode_table);
+	while (hash_next (&i)) {
+		struct inode *inode = hash_entry (hash_cur (&i), struct inode, key.elem);
+
+		lock_acquire (&inode->lock);
+		if (!inode->removed)
+			inode_flush (inode);
+		lock_release (&inode->lock);
+	}
+	lock_release (&inode_table_lock);
+	journal_end ();
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 	void
@@ -311,3 +796,31 @@ off_t
 inode_length (const struct inode *inode) {
 	return inode->data.length;
 }
+
+/* Returns a hash value for inode key E. */
+static uint64_t
+inode_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_int (hash_entry (e, struct inode_key, elem)->sector);
+}
+
+/* Returns true if inode key A precedes inode key B. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct inode_key, elem)->sector
+		< hash_entry (b, struct inode_key, elem)->sector;
+}
+
+/* Returns the in-memory inode for SECTOR, open or cached, or a null
+ * pointer if there is none.  The caller must hold inode_table_lock. */
+static struct inode *
+inode_lookup (disk_sector_t sector) {
+	struct inode_key key;
+	struct hash_elem *e;
+
+	ASSERT (lock_held_by_current_thread (&inode_table_lock));
+
+	key.sector = sector;
+	e = hash_find (&inode_table, &key.elem);
+	return e != NULL ? hash_entry (e, struct inode, key.elem) : NULL;
+}
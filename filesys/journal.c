@@ -0,0 +1,440 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Write-ahead journal for file system metadata.
+ *
+ * Metadata sectors (inodes, directories, and the free map) are not
+ * written to their home locations directly.  journal_write()
+ * records their new contents in the running transaction, in
+ * memory, where journal_read() finds them again.  Committing the
+ * transaction writes its sectors to the log area of the journal,
+ * then a header that lists their home locations, then the sectors
+ * to their home locations, and finally clears the header.  Writing
+ * the header is the commit point: journal_init() replays a header
+ * that is still there at boot, so after a crash every transaction
+ * is either wholly in place or not at all.
+ *
+ * Commits are batched: a transaction collects the updates of every
+ * file system operation for JOURNAL_COMMIT_MS milliseconds after
+ * its first update, or until it holds JOURNAL_TXN_FULL sectors,
+ * whichever comes first.  Operations bracket their updates with
+ * journal_begin() and journal_end() so that a commit never splits
+ * one.  journal_begin() reserves room in the transaction for
+ * JOURNAL_OP_MAX sectors, first committing it if that much is not
+ * free, so only an operation that outgrows its own reservation can
+ * find the transaction full and be split.
+ *
+ * File data is written in place, as before.  Disk writes are
+ * synchronous, so data always reaches the disk before metadata
+ * that refers to it commits.  For the same reason, sectors freed by
+ * a transaction must not be reused until it commits: until then,
+ * the metadata on disk may still point to them.  The free map
+ * hands them to journal_defer_free(), and takes them back from
+ * journal_pop_freed() once their transaction has committed.
+ *
+ * To test replay, the -jc option keeps transactions open until
+ * shutdown, then powers off half way through writing the last one
+ * to its home locations, after its commit point. */
+
+/* Identifies a committed journal header. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* Most sectors in one transaction, and the number at which
+ * journal_end() commits without waiting for the timer. */
+#define JOURNAL_TXN_MAX 120
+#define JOURNAL_TXN_FULL 96
+
+/* Sectors reserved for each operation: more than any ordinary
+ * operation updates. */
+#define JOURNAL_OP_MAX 16
+
+/* Time a transaction stays open after its first update. */
+#define JOURNAL_COMMIT_MS 50
+
+/* On-disk journal header, in sector JOURNAL_SECTOR.  The log area
+ * follows it.  Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct journal_header {
+	unsigned magic;                     /* JOURNAL_MAGIC if committed. */
+	uint32_t cnt;                       /* Number of logged sectors. */
+	disk_sector_t home[JOURNAL_TXN_MAX];/* Home of each logged sector. */
+	uint32_t unused[6];                 /* Not used. */
+};
+
+/* -jc: Crash part way through the commit at shutdown? */
+bool journal_crash;
+
+static bool enabled;                    /* Initialized for this disk? */
+static bool crashing;                   /* Crash in the next commit? */
+static struct journal_header header;    /* Header being written. */
+
+/* Running transaction. */
+static size_t txn_cnt;                  /* Number of sectors. */
+static size_t txn_reserved;             /* Sectors reserved, not yet used. */
+static disk_sector_t txn_sector[JOURNAL_TXN_MAX]; /* Home locations. */
+static uint8_t *txn_data;               /* Contents, back to back. */
+static struct list txn_freed;           /* Runs of sectors it freed. */
+
+/* Runs freed by committed transactions, for the free map to reuse. */
+static struct list committed_freed;
+
+/* A run of freed sectors. */
+struct freed_run {
+	struct list_elem elem;              /* In txn_freed or committed_freed. */
+	disk_sector_t sector;               /* First sector. */
+	size_t cnt;                         /* Number of sectors. */
+};
+
+/* Synchronization.  An operation in progress holds a handle;
+ * journal_commit() waits for all handles to be dropped and holds
+ * off new ones meanwhile. */
+static struct lock journal_lock;        /* Protects everything here. */
+static int active_cnt;                  /* Number of handles. */
+static int commit_waiters;              /* Commits waiting on handles. */
+static struct condition handles_dropped;/* Signaled when active_cnt = 0. */
+static struct condition commit_done;    /* Signaled when commits are done. */
+static struct semaphore txn_started;    /* Up when a new txn begins. */
+
+/* Statistics. */
+static unsigned long long op_cnt;       /* Operations begun. */
+static unsigned long long commit_cnt;   /* Transactions committed. */
+static unsigned long long logged_cnt;   /* Sectors committed. */
+
+static void commitd (void *);
+static void commit_when_idle (void);
+static void do_commit (void);
+static int txn_find (disk_sector_t);
+
+/* Initializes the journal.  If FORMAT is true, clears it;
+ * otherwise, first replays any transaction that was committed but
+ * maybe not checkpointed before the last shutdown. */
+void
+journal_init (bool format) {
+	ASSERT (sizeof header == DISK_SECTOR_SIZE);
+
+	lock_init (&journal_lock);
+	cond_init (&handles_dropped);
+	cond_init (&commit_done);
+	sema_init (&txn_started, 0);
+	list_init (&txn_freed);
+	list_init (&committed_freed);
+	txn_data = palloc_get_multiple (PAL_ASSERT,
+			DIV_ROUND_UP (JOURNAL_TXN_MAX * DISK_SECTOR_SIZE, PGSIZE));
+
+	if (!format) {
+		disk_read (filesys_disk, JOURNAL_SECTOR, &header);
+		if (header.magic == JOURNAL_MAGIC && header.cnt <= JOURNAL_TXN_MAX) {
+			size_t i;
+
+			disk_read_multiple (filesys_disk, JOURNAL_SECTOR + 1, header.cnt,
+					txn_data);
+			for (i = 0; i < header.cnt; i++)
+				disk_write (filesys_disk, header.home[i],
+						txn_data + i * DISK_SECTOR_SIZE);
+			if (header.cnt > 0)
+				printf ("journal: replayed %u sectors\n", header.cnt);
+		}
+	}
+	memset (&header, 0, sizeof header);
+	disk_write (filesys_disk, JOURNAL_SECTOR, &header);
+
+	enabled = true;
+	if (!journal_crash)
+		thread_create ("jcommitd", PRI_DEFAULT, commitd, NULL);
+}
+
+/* Commits the running transaction.  Called at shutdown. */
+void
+journal_done (void) {
+	crashing = journal_crash;
+	journal_commit ();
+}
+
+/* Starts an operation whose metadata updates must commit together,
+ * reserving room for them in the running transaction.  If it has
+ * too little room left, waits for the operations in progress to
+ * end and commits it first.  Nests: only the outermost
+ * journal_begin() and journal_end() of a thread count.  Must be
+ * called before taking any lock that another operation may hold
+ * while calling journal_begin(). */
+void
+journal_begin (void) {
+	struct thread *t = thread_current ();
+
+	if (!enabled || t->journal_depth++ > 0)
+		return;
+
+	lock_acquire (&journal_lock);
+	for (;;) {
+		while (commit_waiters > 0)
+			cond_wait (&commit_done, &journal_lock);
+		if (txn_cnt + txn_reserved + JOURNAL_OP_MAX <= JOURNAL_TXN_MAX)
+			break;
+		commit_when_idle ();
+	}
+	active_cnt++;
+	op_cnt++;
+	txn_reserved += JOURNAL_OP_MAX;
+	t->journal_credits = JOURNAL_OP_MAX;
+	lock_release (&journal_lock);
+}
+
+/* Ends an operation started with journal_begin(), committing the
+ * running transaction if it is nearly full. */
+void
+journal_end (void) {
+	bool full;
+
+	if (!enabled)
+		return;
+	ASSERT (thread_current ()->journal_depth > 0);
+	if (--thread_current ()->journal_depth > 0)
+		return;
+
+	lock_acquire (&journal_lock);
+	txn_reserved -= thread_current ()->journal_credits;
+	thread_current ()->journal_credits = 0;
+	if (--active_cnt == 0)
+		cond_broadcast (&handles_dropped, &journal_lock);
+	full = txn_cnt >= JOURNAL_TXN_FULL;
+	lock_release (&journal_lock);
+
+	if (full)
+		journal_commit ();
+}
+
+/* Reads metadata SECTOR into BUFFER, which must have room for
+ * DISK_SECTOR_SIZE bytes, including any update that has not been
+ * committed yet. */
+void
+journal_read (disk_sector_t sector, void *buffer) {
+	if (enabled) {
+		int i;
+
+		lock_acquire (&journal_lock);
+		i = txn_find (sector);
+		if (i >= 0) {
+			memcpy (buffer, txn_data + i * DISK_SECTOR_SIZE, DISK_SECTOR_SIZE);
+			lock_release (&journal_lock);
+			return;
+		}
+		lock_release (&journal_lock);
+	}
+	disk_read (filesys_disk, sector, buffer);
+}
+
+/* Records BUFFER, which must be DISK_SECTOR_SIZE bytes long, as the
+ * new contents of metadata SECTOR in the running transaction. */
+void
+journal_write (disk_sector_t sector, const void *buffer) {
+	struct thread *t = thread_current ();
+	int i;
+
+	if (!enabled) {
+		disk_write (filesys_disk, sector, buffer);
+		return;
+	}
+
+	lock_acquire (&journal_lock);
+	i = txn_find (sector);
+	if (i < 0) {
+		if (t->journal_depth > 0 && t->journal_credits > 0) {
+			t->journal_credits--;
+			txn_reserved--;
+		} else if (txn_cnt + txn_reserved == JOURNAL_TXN_MAX) {
+			/* This operation has outgrown its reservation and the
+			 * transaction is full, so commit it part way. */
+			do_commit ();
+		}
+		if (txn_cnt == 0)
+			sema_up (&txn_started);
+		i = txn_cnt++;
+		txn_sector[i] = sector;
+	}
+	memcpy (txn_data + i * DISK_SECTOR_SIZE, buffer, DISK_SECTOR_SIZE);
+	lock_release (&journal_lock);
+}
+
+/* Drops any uncommitted update to the CNT sectors starting at
+ * SECTOR, which are being freed, so that committing cannot
+ * overwrite whatever they are reused for. */
+void
+journal_forget (disk_sector_t sector, size_t cnt) {
+	size_t i;
+
+	if (!enabled)
+		return;
+
+	lock_acquire (&journal_lock);
+	for (i = 0; i < txn_cnt; ) {
+		if (txn_sector[i] >= sector && txn_sector[i] - sector < cnt) {
+			txn_cnt--;
+			txn_sector[i] = txn_sector[txn_cnt];
+			memcpy (txn_data + i * DISK_SECTOR_SIZE,
+					txn_data + txn_cnt * DISK_SECTOR_SIZE, DISK_SECTOR_SIZE);
+		} else
+			i++;
+	}
+	lock_release (&journal_lock);
+}
+
+/* Holds the CNT sectors starting at SECTOR, freed by the running
+ * transaction, back from reuse until it commits.  Returns true if
+ * it does, in which case journal_pop_freed() returns them later,
+ * or false if the journal is not in use and the caller may reuse
+ * them now.  If memory is short, the sectors are not reused until
+ * the next boot. */
+bool
+journal_defer_free (disk_sector_t sector, size_t cnt) {
+	struct freed_run *r;
+
+	if (!enabled)
+		return false;
+	r = malloc (sizeof *r);
+	if (r != NULL) {
+		r->sector = sector;
+		r->cnt = cnt;
+		lock_acquire (&journal_lock);
+		list_push_back (&txn_freed, &r->elem);
+		lock_release (&journal_lock);
+	}
+	return true;
+}
+
+/* Takes a run of sectors whose freeing has committed, stores it in
+ * *SECTOR and *CNT, and returns true, or returns false if there is
+ * none. */
+bool
+journal_pop_freed (disk_sector_t *sector, size_t *cnt) {
+	struct freed_run *r = NULL;
+
+	if (!enabled)
+		return false;
+	lock_acquire (&journal_lock);
+	if (!list_empty (&committed_freed))
+		r = list_entry (list_pop_front (&committed_freed),
+				struct freed_run, elem);
+	lock_release (&journal_lock);
+	if (r == NULL)
+		return false;
+	*sector = r->sector;
+	*cnt = r->cnt;
+	free (r);
+	return true;
+}
+
+/* Waits for operations in progress to end, then commits the
+ * running transaction.  The caller must not be in the middle of an
+ * operation itself. */
+void
+journal_commit (void) {
+	if (!enabled)
+		return;
+	ASSERT (thread_current ()->journal_depth == 0);
+
+	lock_acquire (&journal_lock);
+	commit_when_idle ();
+	lock_release (&journal_lock);
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void) {
+	if (enabled)
+		printf ("Journal: %llu operations, %llu commits, "
+				"%llu sectors logged\n", op_cnt, commit_cnt, logged_cnt);
+}
+
+/* Holds off new operations, waits for those in progress to end,
+ * and commits the running transaction.  The caller must hold
+ * journal_lock. */
+static void
+commit_when_idle (void) {
+	ASSERT (lock_held_by_current_thread (&journal_lock));
+
+	commit_waiters++;
+	while (active_cnt > 0)
+		cond_wait (&handles_dropped, &journal_lock);
+	do_commit ();
+	if (--commit_waiters == 0)
+		cond_broadcast (&commit_done, &journal_lock);
+}
+
+/* Writes the running transaction to the log, commits it, writes it
+ * to its home locations, and starts a new, empty transaction.
+ * The caller must hold journal_lock. */
+static void
+do_commit (void) {
+	size_t i;
+
+	ASSERT (lock_held_by_current_thread (&journal_lock));
+
+	if (txn_cnt == 0) {
+		/* Nothing on disk refers to what it freed. */
+		while (!list_empty (&txn_freed))
+			list_push_back (&committed_freed, list_pop_front (&txn_freed));
+		return;
+	}
+
+	/* Log, then commit. */
+	disk_write_multiple (filesys_disk, JOURNAL_SECTOR + 1, txn_cnt, txn_data);
+	header.magic = JOURNAL_MAGIC;
+	header.cnt = txn_cnt;
+	memcpy (header.home, txn_sector, txn_cnt * sizeof *txn_sector);
+	disk_write (filesys_disk, JOURNAL_SECTOR, &header);
+
+	/* Checkpoint, then retire the transaction. */
+	for (i = 0; i < txn_cnt; i++) {
+		if (crashing && i == txn_cnt / 2) {
+			printf ("journal: crashing after %zu of %zu sectors\n",
+					i, txn_cnt);
+			power_off_unclean ();
+		}
+		disk_write (filesys_disk, txn_sector[i],
+				txn_data + i * DISK_SECTOR_SIZE);
+	}
+	memset (&header, 0, sizeof header);
+	disk_write (filesys_disk, JOURNAL_SECTOR, &header);
+
+	/* What the transaction freed may be reused now. */
+	while (!list_empty (&txn_freed))
+		list_push_back (&committed_freed, list_pop_front (&txn_freed));
+
+	commit_cnt++;
+	logged_cnt += txn_cnt;
+	txn_cnt = 0;
+}
+
+/* Commit thread.  Sleeps until a transaction starts, then commits
+ * it JOURNAL_COMMIT_MS later. */
+static void
+commitd (void *aux UNUSED) {
+	for (;;) {
+		sema_down (&txn_started);
+		timer_msleep (JOURNAL_COMMIT_MS);
+		journal_commit ();
+	}
+}
+
+/* Returns the index of SECTOR in the running transaction, or -1 if
+ * it is not there.  The caller must hold journal_lock. */
+static int
+txn_find (disk_sector_t sector) {
+	size_t i;
+
+	for (i = 0; i < txn_cnt; i++)
+		if (txn_sector[i] == sector)
+			return i;
+	return -1;
+}
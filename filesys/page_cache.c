@@ -1,50 +1,701 @@
-/* page_cache.c: Implementation of Page Cache (Buffer Cache). */
-
-#include "vm/vm.h"
-static bool page_cache_readahead (struct page *page, void *kva);
-static bool page_cache_writeback (struct page *page);
-static void page_cache_destroy (struct page *page);
-
-/* DO NOT MODIFY this struct */
-static const struct page_operations page_cache_op = {
-	.swap_in = page_cache_readahead,
-	.swap_out = page_cache_writeback,
-	.destroy = page_cache_destroy,
-	.type = VM_PAGE_CACHE,
-};
+/* page_cache.c: Implementation of Page Cache (Buffer Cache).
+ *
+ * The data of regular files is cached in whole pages, each holding
+ * the PGSIZE bytes of a file at a page-aligned offset, found by file
+ * and offset in cache_table.  inode_read_at() and inode_write_at()
+ * copy to and from these pages instead of going to the disk: a page
+ * is read in with one request on first use, or not at all if a
+ * write covers it, and a write only marks it dirty.  Dirty pages
+ * are written back when they are evicted, when the last opener of
+ * their file closes it, every PAGE_CACHE_FLUSH_MS milliseconds by
+ * the kworkerd thread, and at shutdown.  A page past the end of its
+ * file reads as zeros.
+ *
+ * Read-ahead: file.c asks with page_cache_readahead() for the pages
+ * after a sequential reader's position, and the kreadahead thread
+ * reads them in while the reader works on what it has, each run of
+ * pages that are not cached yet with one request through ra_buf.
+ * Requests wait in ra_queue, and are dropped if it is full.
+ *
+ * With VM, the pages of mapped files are the cache's pages
+ * themselves: page_cache_map() hands a page to the frame table to
+ * map into processes, so that read(), write() and every mapping of
+ * a file see the same memory, and nothing is cached twice.  Such a
+ * page comes from the user pool, like any other frame, and the
+ * frame table can evict it and take it over with
+ * page_cache_reclaim().  Modifications through a mapping reach the
+ * cache when the frame table finds the page dirty, at eviction,
+ * munmap(), or exit.
+ *
+ * The cache keeps up to PAGE_CACHE_MAX pages, evicted in clock
+ * order, and more only while all of them are in use.  Metadata,
+ * which goes through the journal, is not cached.  A new file has no
+ * sectors on disk until its first dirty page is written back, which
+ * allocates them; until then its pages read in as zeros.  See
+ * inode.c.
+ *
+ * cache_lock protects the table and the pages' fields, but is not
+ * held while a page's data is copied or goes to or from the disk, so
+ * that a copy may fault on a user page.  Instead, a page is pinned
+ * while in use, which keeps it from being evicted, and marked `io'
+ * while it is read in or written back, which others wait for. */
+
+#include "filesys/page_cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/inode.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Pages the cache keeps when none are in use. */
+#define PAGE_CACHE_MAX 64
+
+/* Time between writebacks by kworkerd. */
+#define PAGE_CACHE_FLUSH_MS 1000
+
+/* Most pages read ahead by one request, and requests waiting. */
+#define RA_MAX_PAGES 16
+#define RA_QUEUE_MAX 8
+
+/* Pool for the cache's pages: with VM they may become frames. */
+#ifdef VM
+#define CACHE_POOL PAL_USER
+#else
+#define CACHE_POOL 0
+#endif
+
+static struct hash cache_table;         /* Pages, by inode and offset. */
+static struct list cache_clock;         /* Pages, in clock order. */
+static struct list_elem *cache_hand;    /* Next page to consider. */
+static size_t cache_cnt;                /* Number of pages. */
+static struct lock cache_lock;          /* Protects the above. */
+static struct condition cache_idle;     /* A page's io or pin ended. */
+
+/* Cache of struct page_cache. */
+static struct kmem_cache *desc_cache;
 
 tid_t page_cache_workerd;
 
-/* The initializer of file vm */
+/* A request to read ahead. */
+struct ra_request {
+	struct inode *inode;                /* File, reopened for us. */
+	off_t ofs;                          /* First page. */
+	size_t cnt;                         /* Number of pages. */
+};
+
+/* Read-ahead requests, a ring buffer protected by cache_lock, and
+ * kreadahead's staging area, RA_MAX_PAGES pages. */
+static struct ra_request ra_queue[RA_QUEUE_MAX];
+static size_t ra_head, ra_cnt;
+static struct condition ra_ready;       /* RA_QUEUE is not empty. */
+static uint8_t *ra_buf;
+
+/* Statistics. */
+static long long hit_cnt;               /* Pages found in the cache. */
+static long long miss_cnt;              /* ...not found, and added. */
+static long long write_cnt;             /* Pages written back. */
+static long long evict_cnt;             /* Pages evicted. */
+static long long ra_read_cnt;           /* Read-ahead requests. */
+static long long ra_page_cnt;           /* ...pages they read. */
+static long long ra_drop_cnt;           /* Requests dropped. */
+
+static hash_hash_func cache_hash;
+static hash_less_func cache_less;
+static void cache_read_in (struct page_cache *);
+static void page_cache_writeback (struct page_cache *);
+static void page_cache_kworkerd (void *aux);
+static void page_cache_kreadahead (void *aux);
+
+/* Initializes the page cache and starts kworkerd. */
 void
 pagecache_init (void) {
-	/* TODO: Create a worker daemon for page cache with page_cache_kworkerd */
+	/* vm_init() calls this as well when VM is built into project 4. */
+	if (desc_cache != NULL)
+		return;
+
+	desc_cache = kmem_cache_create ("page_cache", sizeof (struct page_cache),
+			NULL);
+	ra_buf = palloc_get_multiple (0, RA_MAX_PAGES);
+	if (desc_cache == NULL || ra_buf == NULL)
+		PANIC ("pagecache_init: out of memory");
+	hash_init (&cache_table, cache_hash, cache_less, NULL);
+	list_init (&cache_clock);
+	cache_hand = list_end (&cache_clock);
+	lock_init (&cache_lock);
+	cond_init (&cache_idle);
+	cond_init (&ra_ready);
+
+	page_cache_workerd = thread_create ("kworkerd", PRI_DEFAULT,
+			page_cache_kworkerd, NULL);
+	if (page_cache_workerd == TID_ERROR
+			|| thread_create ("kreadahead", PRI_DEFAULT, page_cache_kreadahead,
+				NULL) == TID_ERROR)
+		PANIC ("pagecache_init: cannot start kernel threads");
 }
 
-/* Initialize the page cache */
-bool
-page_cache_initializer (struct page *page, enum vm_type type, void *kva) {
-	/* Set up the handler */
-	page->operations = &page_cache_op;
+/* Returns the page for OFS in INODE, or a null pointer if it is not
+ * cached.  The caller must hold cache_lock. */
+static struct page_cache *
+cache_lookup (struct inode *inode, off_t ofs) {
+	struct page_cache key;
+	struct hash_elem *e;
 
+	key.inode = inode;
+	key.ofs = ofs;
+	e = hash_find (&cache_table, &key.elem);
+	return e != NULL ? hash_entry (e, struct page_cache, elem) : NULL;
 }
 
-/* Utilze the Swap in mechanism to implement readhead */
-static bool
-page_cache_readahead (struct page *page, void *kva) {
+/* Drops a pin on PC.  The caller must hold cache_lock. */
+static void
+cache_unpin (struct page_cache *pc) {
+	ASSERT (pc->pin_cnt > 0);
+	pc->pin_cnt--;
+	cond_broadcast (&cache_idle, &cache_lock);
 }
 
-/* Utilze the Swap out mechanism to implement writeback */
-static bool
-page_cache_writeback (struct page *page) {
+/* Removes PC from the cache and frees it, but not its data page.
+ * The caller must hold cache_lock. */
+static void
+cache_remove (struct page_cache *pc) {
+	if (cache_hand == &pc->clock_elem)
+		cache_hand = list_next (cache_hand);
+	list_remove (&pc->clock_elem);
+	hash_delete (&cache_table, &pc->elem);
+	cache_cnt--;
+	kmem_cache_free (desc_cache, pc);
+}
+
+/* Returns the page to evict, chosen by second chance among the pages
+ * not in use, or a null pointer if all are in use.  The caller must
+ * hold cache_lock. */
+static struct page_cache *
+cache_victim (void) {
+	size_t i;
+
+	for (i = 0; i < 2 * cache_cnt; i++) {
+		struct page_cache *pc;
+
+		if (cache_hand == list_end (&cache_clock))
+			cache_hand = list_begin (&cache_clock);
+		pc = list_entry (cache_hand, struct page_cache, clock_elem);
+		cache_hand = list_next (cache_hand);
+
+		if (pc->pin_cnt > 0 || pc->io)
+			continue;
+		if (pc->accessed)
+			pc->accessed = false;
+		else
+			return pc;
+	}
+	return NULL;
+}
+
+/* Returns a page for new cache data, evicting a page if the cache is
+ * full, or a null pointer if no page is available.  The caller must
+ * hold cache_lock, which is released while a dirty victim is written
+ * back, so the caller must look up again afterward whether its page
+ * was cached meanwhile. */
+static void *
+cache_alloc (void) {
+	void *kva = NULL;
+
+	if (cache_cnt < PAGE_CACHE_MAX)
+		kva = palloc_get_page (CACHE_POOL);
+	while (kva == NULL) {
+		struct page_cache *pc = cache_victim ();
+
+		if (pc == NULL)
+			return palloc_get_page (CACHE_POOL);
+		if (pc->dirty) {
+			pc->pin_cnt++;
+			page_cache_writeback (pc);
+			cache_unpin (pc);
+			continue;
+		}
+		kva = pc->kva;
+		cache_remove (pc);
+		evict_cnt++;
+	}
+	return kva;
+}
+
+/* Adds a page for OFS in INODE to the cache and returns it, pinned
+ * and marked io, for the caller to fill in.  Returns a null pointer
+ * if no page is available, or if the page has been cached meanwhile,
+ * since the caller must hold cache_lock, which cache_alloc() may
+ * release. */
+static struct page_cache *
+cache_add (struct inode *inode, off_t ofs) {
+	uint8_t *kva = cache_alloc ();
+	struct page_cache *pc;
+
+	if (kva == NULL)
+		return NULL;
+	if (cache_lookup (inode, ofs) != NULL
+			|| (pc = kmem_cache_alloc (desc_cache)) == NULL) {
+		palloc_free_page (kva);
+		return NULL;
+	}
+	pc->inode = inode;
+	pc->ofs = ofs;
+	pc->kva = kva;
+	pc->pin_cnt = 1;
+	pc->io = true;
+	pc->dirty = false;
+	pc->accessed = true;
+	hash_insert (&cache_table, &pc->elem);
+	list_insert (cache_hand, &pc->clock_elem);
+	cache_cnt++;
+	return pc;
+}
+
+/* Marks PC, which the caller filled in, no longer io, and unpins it
+ * if UNPIN is true.  The caller must hold cache_lock. */
+static void
+cache_filled (struct page_cache *pc, bool unpin) {
+	pc->io = false;
+	if (unpin)
+		cache_unpin (pc);
+	else
+		cond_broadcast (&cache_idle, &cache_lock);
+}
+
+/* Returns the page for OFS in INODE, pinned, adding it to the cache
+ * if it is not there, or a null pointer if no page is available.
+ * A new page is read in, unless WHOLE is true because the caller
+ * overwrites all of it: then it starts out as zeros.  The caller
+ * must hold cache_lock, which may be released meanwhile. */
+static struct page_cache *
+cache_get (struct inode *inode, off_t ofs, bool whole) {
+	struct page_cache *pc;
+
+	ASSERT (ofs % PGSIZE == 0);
+
+	while ((pc = cache_lookup (inode, ofs)) == NULL) {
+		pc = cache_add (inode, ofs);
+		if (pc != NULL) {
+			miss_cnt++;
+			if (whole)
+				memset (pc->kva, 0, PGSIZE);
+			else {
+				lock_release (&cache_lock);
+				cache_read_in (pc);
+				lock_acquire (&cache_lock);
+			}
+			cache_filled (pc, false);
+			return pc;
+		}
+		if (cache_lookup (inode, ofs) == NULL)
+			return NULL;
+	}
+
+	hit_cnt++;
+	pc->pin_cnt++;
+	pc->accessed = true;
+	while (pc->io)
+		cond_wait (&cache_idle, &cache_lock);
+	return pc;
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position
+ * OFFSET, through the cache.  Returns the number of bytes actually
+ * read, which may be less than SIZE if end of file is reached. */
+off_t
+page_cache_read (struct inode *inode, void *buffer_, off_t size,
+		off_t offset) {
+	uint8_t *buffer = buffer_;
+	off_t bytes_read = 0;
+
+	while (size > 0) {
+		off_t page_ofs = offset % PGSIZE;
+		off_t inode_left = inode_length (inode) - offset;
+		off_t page_left = PGSIZE - page_ofs;
+		off_t min_left = inode_left < page_left ? inode_left : page_left;
+		off_t chunk_size = size < min_left ? size : min_left;
+		struct page_cache *pc;
+
+		if (chunk_size <= 0)
+			break;
+
+		lock_acquire (&cache_lock);
+		pc = cache_get (inode, offset - page_ofs, false);
+		lock_release (&cache_lock);
+		if (pc != NULL) {
+			memcpy (buffer + bytes_read, pc->kva + page_ofs, chunk_size);
+			lock_acquire (&cache_lock);
+			cache_unpin (pc);
+			lock_release (&cache_lock);
+		} else if (inode_read_disk (inode, buffer + bytes_read, chunk_size,
+					offset) != chunk_size) {
+			/* The page is not cached, for want of memory, so the disk
+			 * has its latest data. */
+			break;
+		}
+
+		size -= chunk_size;
+		offset += chunk_size;
+		bytes_read += chunk_size;
+	}
+	return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET,
+ * through the cache.  Returns the number of bytes actually written,
+ * which may be less than SIZE if end of file is reached or memory
+ * runs out. */
+off_t
+page_cache_write (struct inode *inode, const void *buffer_, off_t size,
+		off_t offset) {
+	const uint8_t *buffer = buffer_;
+	off_t bytes_written = 0;
+
+	while (size > 0) {
+		off_t page_ofs = offset % PGSIZE;
+		off_t inode_left = inode_length (inode) - offset;
+		off_t page_left = PGSIZE - page_ofs;
+		off_t min_left = inode_left < page_left ? inode_left : page_left;
+		off_t chunk_size = size < min_left ? size : min_left;
+		struct page_cache *pc;
+
+		if (chunk_size <= 0)
+			break;
+
+		lock_acquire (&cache_lock);
+		pc = cache_get (inode, offset - page_ofs,
+				page_ofs == 0 && chunk_size == min_left);
+		lock_release (&cache_lock);
+		if (pc == NULL)
+			break;
+		memcpy (pc->kva + page_ofs, buffer + bytes_written, chunk_size);
+		lock_acquire (&cache_lock);
+		pc->dirty = true;
+		cache_unpin (pc);
+		lock_release (&cache_lock);
+
+		size -= chunk_size;
+		offset += chunk_size;
+		bytes_written += chunk_size;
+	}
+	return bytes_written;
+}
+
+/* Reads PC in from its file, with zeros past the end of the file.
+ * PC is marked io, so no lock is needed. */
+static void
+cache_read_in (struct page_cache *pc) {
+	off_t left = inode_length (pc->inode) - pc->ofs;
+	off_t bytes = left < PGSIZE ? left : PGSIZE;
+
+	if (inode_read_disk (pc->inode, pc->kva, bytes, pc->ofs) != bytes)
+		bytes = 0;
+	memset (pc->kva + bytes, 0, PGSIZE - bytes);
+}
+
+/* Reads the CNT pages of INODE from OFS into the cache, stopping at
+ * the end of the file, with one request for each run of them that
+ * is not cached yet.  New pages are not marked accessed, so that
+ * those never read are the first evicted.  Called by kreadahead
+ * only, which owns ra_buf. */
+static void
+cache_read_ahead (struct inode *inode, off_t ofs, size_t cnt) {
+	struct page_cache *run[RA_MAX_PAGES];
+	off_t length = inode_length (inode);
+
+	ASSERT (cnt <= RA_MAX_PAGES);
+
+	lock_acquire (&cache_lock);
+	while (cnt > 0 && ofs < length) {
+		off_t left, bytes;
+		size_t n = 0, i;
+
+		while (n < cnt && ofs + (off_t) n * PGSIZE < length) {
+			struct page_cache *pc = cache_add (inode, ofs + n * PGSIZE);
+			if (pc == NULL)
+				break;
+			pc->accessed = false;
+			run[n++] = pc;
+		}
+		if (n == 0) {
+			/* Skip a page that is cached already; give up if there is no
+			 * memory. */
+			if (cache_lookup (inode, ofs) == NULL)
+				break;
+			ofs += PGSIZE;
+			cnt--;
+			continue;
+		}
+
+		lock_release (&cache_lock);
+		left = length - ofs;
+		bytes = left < (off_t) n * PGSIZE ? left : (off_t) n * PGSIZE;
+		if (inode_read_disk (inode, ra_buf, bytes, ofs) != bytes)
+			bytes = 0;
+		memset (ra_buf + bytes, 0, n * PGSIZE - bytes);
+		for (i = 0; i < n; i++)
+			memcpy (run[i]->kva, ra_buf + i * PGSIZE, PGSIZE);
+		lock_acquire (&cache_lock);
+
+		for (i = 0; i < n; i++)
+			cache_filled (run[i], true);
+		ra_read_cnt++;
+		ra_page_cnt += n;
+		ofs += n * PGSIZE;
+		cnt -= n;
+	}
+	lock_release (&cache_lock);
+}
+
+/* Starts reading the CNT pages of INODE from OFS, which must be
+ * page-aligned, into the cache in the background.  INODE must hold
+ * file data and have its sectors.  Does nothing if too many requests
+ * are waiting already. */
+void
+page_cache_readahead (struct inode *inode, off_t ofs, size_t cnt) {
+	struct ra_request *req = NULL;
+
+	ASSERT (ofs % PGSIZE == 0);
+
+	if (cnt == 0)
+		return;
+	if (cnt > RA_MAX_PAGES)
+		cnt = RA_MAX_PAGES;
+
+	/* The request keeps INODE open.  Reopen it first, since the inode
+	 * table's lock is taken before cache_lock. */
+	inode = inode_reopen (inode);
+	lock_acquire (&cache_lock);
+	if (ra_cnt < RA_QUEUE_MAX) {
+		req = &ra_queue[(ra_head + ra_cnt++) % RA_QUEUE_MAX];
+		req->inode = inode;
+		req->ofs = ofs;
+		req->cnt = cnt;
+		cond_signal (&ra_ready, &cache_lock);
+	} else
+		ra_drop_cnt++;
+	lock_release (&cache_lock);
+	if (req == NULL)
+		inode_close (inode);
+}
+
+/* Read-ahead thread: carries out page_cache_readahead() requests in
+ * order. */
+static void
+page_cache_kreadahead (void *aux UNUSED) {
+	for (;;) {
+		struct ra_request req;
+
+		lock_acquire (&cache_lock);
+		while (ra_cnt == 0)
+			cond_wait (&ra_ready, &cache_lock);
+		req = ra_queue[ra_head];
+		ra_head = (ra_head + 1) % RA_QUEUE_MAX;
+		ra_cnt--;
+		lock_release (&cache_lock);
+
+		cache_read_ahead (req.inode, req.ofs, req.cnt);
+		inode_close (req.inode);
+	}
 }
 
-/* Destory the page_cache. */
+/* Writes PC, which the caller has pinned, back to its file if it is
+ * dirty, after any read in or writeback under way.  The caller must
+ * hold cache_lock, which is released during the write. */
 static void
-page_cache_destroy (struct page *page) {
+page_cache_writeback (struct page_cache *pc) {
+	off_t left, bytes;
+
+	ASSERT (pc->pin_cnt > 0);
+
+	while (pc->io)
+		cond_wait (&cache_idle, &cache_lock);
+	if (!pc->dirty)
+		return;
+
+	/* Clear the dirty bit first, so that writes made while the page
+	 * is written out are not lost. */
+	pc->io = true;
+	pc->dirty = false;
+	lock_release (&cache_lock);
+	left = inode_length (pc->inode) - pc->ofs;
+	bytes = left < PGSIZE ? left : PGSIZE;
+	if (bytes > 0)
+		inode_write_disk (pc->inode, pc->kva, bytes, pc->ofs);
+	lock_acquire (&cache_lock);
+	pc->io = false;
+	cond_broadcast (&cache_idle, &cache_lock);
+	write_cnt++;
+}
+
+/* Writes back the dirty pages of INODE, or of every file if INODE is
+ * null. */
+static void
+cache_flush (struct inode *inode) {
+	struct list_elem *e;
+
+	lock_acquire (&cache_lock);
+	for (e = list_begin (&cache_clock); e != list_end (&cache_clock);
+			e = list_next (e)) {
+		struct page_cache *pc = list_entry (e, struct page_cache, clock_elem);
+
+		/* PC stays in the list while pinned, so E remains valid. */
+		if ((inode == NULL || pc->inode == inode) && (pc->dirty || pc->io)) {
+			pc->pin_cnt++;
+			page_cache_writeback (pc);
+			cache_unpin (pc);
+		}
+	}
+	lock_release (&cache_lock);
+}
+
+/* Returns true if INODE has pages that page_cache_flush() would
+ * write back. */
+bool
+page_cache_dirty (struct inode *inode) {
+	struct list_elem *e;
+	bool dirty = false;
+
+	lock_acquire (&cache_lock);
+	for (e = list_begin (&cache_clock); e != list_end (&cache_clock) && !dirty;
+			e = list_next (e)) {
+		struct page_cache *pc = list_entry (e, struct page_cache, clock_elem);
+		dirty = pc->inode == inode && (pc->dirty || pc->io);
+	}
+	lock_release (&cache_lock);
+	return dirty;
+}
+
+/* Writes back INODE's dirty pages. */
+void
+page_cache_flush (struct inode *inode) {
+	ASSERT (inode != NULL);
+	cache_flush (inode);
 }
 
-/* Worker thread for page cache */
+/* Writes back every dirty page. */
+void
+page_cache_flush_all (void) {
+	cache_flush (NULL);
+}
+
+/* Drops INODE's pages from the cache without writing them back, once
+ * nobody is using them.  Called before INODE is freed. */
+void
+page_cache_discard (struct inode *inode) {
+	struct list_elem *e;
+
+	lock_acquire (&cache_lock);
+	for (e = list_begin (&cache_clock); e != list_end (&cache_clock); ) {
+		struct page_cache *pc = list_entry (e, struct page_cache, clock_elem);
+
+		if (pc->inode != inode) {
+			e = list_next (e);
+			continue;
+		}
+		pc->pin_cnt++;
+		while (pc->pin_cnt > 1 || pc->io)
+			cond_wait (&cache_idle, &cache_lock);
+		e = list_next (e);
+		palloc_free_page (pc->kva);
+		cache_remove (pc);
+	}
+	lock_release (&cache_lock);
+}
+
+/* Worker thread for page cache.  Writes back the dirty pages every
+ * PAGE_CACHE_FLUSH_MS milliseconds, so that little is lost in a
+ * crash and shutdown has little left to do. */
 static void
-page_cache_kworkerd (void *aux) {
+page_cache_kworkerd (void *aux UNUSED) {
+	for (;;) {
+		timer_msleep (PAGE_CACHE_FLUSH_MS);
+		page_cache_flush_all ();
+	}
+}
+
+/* Prints page cache statistics. */
+void
+page_cache_print_stats (void) {
+	printf ("Page cache: %lld hits, %lld misses, %lld pages written back, "
+			"%lld evicted\n", hit_cnt, miss_cnt, write_cnt, evict_cnt);
+	printf ("Page cache: %lld pages read ahead in %lld reads, "
+			"%lld requests dropped\n", ra_page_cnt, ra_read_cnt, ra_drop_cnt);
+}
+
+#ifdef VM
+/* Returns the page for OFS in INODE, read in if needed, for the
+ * frame table to map into processes, or a null pointer if no page
+ * is available.  The page stays pinned until page_cache_unmap() or
+ * page_cache_reclaim(). */
+struct page_cache *
+page_cache_map (struct inode *inode, off_t ofs) {
+	struct page_cache *pc;
+
+	lock_acquire (&cache_lock);
+	pc = cache_get (inode, ofs, false);
+	lock_release (&cache_lock);
+	return pc;
+}
+
+/* Records that mapped page PC was modified through a mapping. */
+void
+page_cache_set_dirty (struct page_cache *pc) {
+	lock_acquire (&cache_lock);
+	pc->dirty = true;
+	lock_release (&cache_lock);
+}
+
+/* Unpins PC, which is no longer mapped. */
+void
+page_cache_unmap (struct page_cache *pc) {
+	lock_acquire (&cache_lock);
+	cache_unpin (pc);
+	lock_release (&cache_lock);
+}
+
+/* Unpins PC, which is no longer mapped, and evicts it, writing it
+ * back if it is dirty, so that the frame table can reuse its data
+ * page.  Returns true if successful, false if PC is in use elsewhere,
+ * in which case it stays in the cache. */
+bool
+page_cache_reclaim (struct page_cache *pc) {
+	bool success = false;
+
+	lock_acquire (&cache_lock);
+	if (pc->pin_cnt == 1)
+		page_cache_writeback (pc);
+	if (pc->pin_cnt == 1 && !pc->dirty) {
+		cache_remove (pc);
+		evict_cnt++;
+		success = true;
+	} else
+		cache_unpin (pc);
+	lock_release (&cache_lock);
+	return success;
+}
+#endif
+
+/* Returns a hash value for the page that E is in. */
+static uint64_t
+cache_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page_cache *pc = hash_entry (e, struct page_cache, elem);
+	return hash_bytes (&pc->inode, sizeof pc->inode) ^ hash_int (pc->ofs);
+}
+
+/* Returns true if the page that A is in precedes the one that B is
+ * in. */
+static bool
+cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct page_cache *a = hash_entry (a_, struct page_cache, elem);
+	const struct page_cache *b = hash_entry (b_, struct page_cache, elem);
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	return a->ofs < b->ofs;
 }
@@ -0,0 +1,27 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+
+/* Number of sectors reserved for the journal, starting at
+ * JOURNAL_SECTOR. */
+#define JOURNAL_SECTORS 128
+
+/* -jc: Crash part way through the commit at shutdown? */
+extern bool journal_crash;
+
+void journal_init (bool format);
+void journal_done (void);
+void journal_begin (void);
+void journal_end (void);
+void journal_read (disk_sector_t, void *);
+void journal_write (disk_sector_t, const void *);
+void journal_forget (disk_sector_t, size_t cnt);
+bool journal_defer_free (disk_sector_t, size_t cnt);
+bool journal_pop_freed (disk_sector_t *, size_t *cnt);
+void journal_commit (void);
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
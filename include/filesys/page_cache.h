@@ -1,12 +1,44 @@
 #ifndef FILESYS_PAGE_CACHE_H
 #define FILESYS_PAGE_CACHE_H
-#include "vm/vm.h"
 
-struct page;
-enum vm_type;
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
 
-struct page_cache {};
+struct inode;
 
-void page_cache_init (void);
-bool page_cache_initializer (struct page *page, enum vm_type type, void *kva);
+/* A page of a file in the page cache. */
+struct page_cache {
+	struct inode *inode;           /* File. */
+	off_t ofs;                     /* Page-aligned offset in INODE. */
+	uint8_t *kva;                  /* Data, zeros past end of file. */
+	int pin_cnt;                   /* Users; not evicted unless 0. */
+	bool io;                       /* Being read in or written back? */
+	bool dirty;                    /* Modified since written back? */
+	bool accessed;                 /* Used since the clock passed? */
+	struct hash_elem elem;         /* Element in the cache table. */
+	struct list_elem clock_elem;   /* Element in the clock list. */
+};
+
+void pagecache_init (void);
+off_t page_cache_read (struct inode *, void *, off_t size, off_t offset);
+off_t page_cache_write (struct inode *, const void *, off_t size,
+		off_t offset);
+void page_cache_readahead (struct inode *, off_t ofs, size_t cnt);
+bool page_cache_dirty (struct inode *);
+void page_cache_flush (struct inode *);
+void page_cache_flush_all (void);
+void page_cache_discard (struct inode *);
+void page_cache_print_stats (void);
+
+#ifdef VM
+struct page_cache *page_cache_map (struct inode *, off_t ofs);
+void page_cache_set_dirty (struct page_cache *);
+void page_cache_unmap (struct page_cache *);
+bool page_cache_reclaim (struct page_cache *);
 #endif
+
+#endif /* filesys/page_cache.h */
@@ -42,7 +42,8 @@ size_t bitmap_scan_and_flip (struct bitmap *, size_t start, size_t cnt, bool);
 struct file;
 size_t bitmap_file_size (const struct bitmap *);
 bool bitmap_read (struct bitmap *, struct file *);
-bool bitmap_write (const struct bitmap *, struct file *);
+bool bitmap_write (struct bitmap *, struct file *);
+bool bitmap_write_dirty (struct bitmap *, struct file *);
 #endif
 
 /* Debugging. */
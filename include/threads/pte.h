@@ -41,5 +41,12 @@
 #define PTE_U 0x4                        /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20                       /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40                       /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80                      /* 1=large page (PDEs only). */
+#define PTE_G 0x100                      /* 1=global, in every address space. */
+
+/* A PDE with PTE_PS set maps a whole large page, instead of pointing
+   to a page table. */
+#define LARGE_PGSIZE (1UL << PDXSHIFT)              /* Bytes (2 MB). */
+#define LARGE_PGCNT (LARGE_PGSIZE >> PTXSHIFT)      /* Small pages. */
 
 #endif /* threads/pte.h */
@@ -0,0 +1,22 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <stddef.h>
+
+/* An object cache. */
+struct kmem_cache;
+
+/* Puts a newly created object into its initial state.  Objects
+ * must be in that state again when they are freed. */
+typedef void kmem_ctor (void *obj);
+
+void slab_init (void);
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+		kmem_ctor *);
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+struct kmem_cache *kmem_cache_of (const void *);
+size_t kmem_cache_size (const struct kmem_cache *);
+void slab_print_stats (void);
+
+#endif /* threads/slab.h */
@@ -117,9 +117,17 @@ struct thread
 	/* Owned by userprog/process.c. */
 	uint64_t *pml4; /* Page map level 4 */
 #endif
+#ifdef FILESYS
+	/* Owned by filesys/inode.c. */
+	void *fs_bounce; /* Sector bounce buffer, allocated on first use. */
+	/* Owned by filesys/journal.c. */
+	int journal_depth; /* Nesting depth of journal_begin(). */
+	int journal_credits; /* Sectors left in its reservation. */
+#endif
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
+	uintptr_t user_rsp; /* User rsp at entry to the last system call. */
 #endif
 
 	/* Owned by thread.c. */
@@ -0,0 +1,23 @@
+#ifndef THREADS_VMALLOC_H
+#define THREADS_VMALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel virtual address range for vmalloc(), above the mapping of
+ * physical memory at KERN_BASE and within the same top-level page
+ * table entry, so that it is shared by every address space. */
+#define VMALLOC_BASE 0xc000000000
+#define VMALLOC_PAGES 16384
+
+/* Returns true if VADDR was allocated by vmalloc(). */
+#define is_vmalloc_addr(vaddr) \
+	((uint64_t) (vaddr) >= VMALLOC_BASE \
+	 && (uint64_t) (vaddr) < VMALLOC_BASE + (uint64_t) VMALLOC_PAGES * 4096)
+
+void vmalloc_init (void);
+void *vmalloc (size_t);
+void vfree (void *);
+
+#endif /* threads/vmalloc.h */
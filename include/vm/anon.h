@@ -1,13 +1,21 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
+#include <stddef.h>
 #include "vm/vm.h"
 struct page;
 enum vm_type;
 
+/* Most pages swapped out or in with one disk request. */
+#define SWAP_CLUSTER 8
+
 struct anon_page {
+	size_t slot;                   /* Swap slot, or BITMAP_ERROR. */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+bool anon_swap_out_cluster (struct page *pages[], size_t cnt);
+void anon_share_slot (size_t slot);
+void swap_print_stats (void);
 
 #endif
@@ -1,6 +1,9 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <hash.h>
+#include <list.h>
+#include "filesys/off_t.h"
 #include "threads/palloc.h"
 
 enum vm_type {
@@ -32,6 +35,7 @@ enum vm_type {
 #endif
 
 struct page_operations;
+struct page_cache;
 struct thread;
 
 #define VM_TYPE(type) ((type) & 7)
@@ -46,6 +50,12 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	struct hash_elem spt_elem;     /* Element in the owner's spt. */
+	struct vm_region *region;      /* Region containing VA, or null. */
+	struct list_elem region_elem;  /* Element in REGION's page list. */
+	struct list_elem frame_elem;   /* Element in FRAME's page list. */
+	struct thread *owner;          /* Process whose pml4 maps VA. */
+	bool writable;                 /* Writable by the user? */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -59,10 +69,25 @@ struct page {
 	};
 };
 
-/* The representation of "frame" */
+/* The representation of "frame".
+ * A frame may be shared by the pages of several processes: at the
+ * same address after a fork(), or wherever the same part of the same
+ * executable or mapped file is mapped.  PAGE is the first of them. */
 struct frame {
 	void *kva;
 	struct page *page;
+	struct list pages;             /* Pages sharing the frame. */
+	size_t ref_cnt;                /* Number of pages in PAGES. */
+	struct list_elem elem;         /* Element in the frame table. */
+
+	/* Part of a file, shared through the file frame table. */
+	struct inode *file_inode;      /* File, or null if not shared. */
+	off_t file_ofs;                /* Offset in FILE_INODE. */
+	size_t file_bytes;             /* Bytes from FILE_INODE. */
+	bool file_text;                /* Program text, or a mapped file? */
+	struct hash_elem file_elem;    /* Element in the file frame table. */
+
+	struct page_cache *cache;      /* Page cache page at KVA, or null. */
 };
 
 /* The function table for page operations.
@@ -81,10 +106,40 @@ struct page_operations {
 #define destroy(page) \
 	if ((page)->operations->destroy) (page)->operations->destroy (page)
 
+/* Kinds of region. */
+enum vm_region_kind {
+	REGION_CODE,                   /* Read-only executable segment. */
+	REGION_DATA,                   /* Writable executable segment. */
+	REGION_STACK,                  /* User stack. */
+	REGION_MMAP,                   /* Memory-mapped file. */
+};
+
+/* A range of user virtual addresses set up by one mapping, such as
+ * an executable segment or an mmap().  The first FILE_BYTES bytes
+ * of the range come from FILE, starting at OFS, and the rest are
+ * zeros.  Any part of the zeros from LARGE_START to LARGE_END has no
+ * pages, and is mapped with large pages instead. */
+struct vm_region {
+	struct list_elem elem;         /* Element in the spt's region list. */
+	uint8_t *start, *end;          /* Page-aligned bounds, END exclusive. */
+	enum vm_region_kind kind;      /* What the region is for. */
+	bool writable;                 /* Writable by the user? */
+	struct file *file;             /* Backing file, owned, or null. */
+	off_t ofs;                     /* Offset in FILE of START. */
+	size_t file_bytes;             /* Bytes backed by FILE. */
+	struct list pages;             /* Existing pages in the region. */
+	uint8_t *large_start;          /* Large-page aligned bounds of the */
+	uint8_t *large_end;            /* ...part mapped with large pages. */
+	void **large;                  /* Its large pages, null if not yet. */
+};
+
 /* Representation of current process's memory space.
- * We don't want to force you to obey any specific design for this struct.
- * All designs up to you for this. */
+ * Pages are found by address in a hash table.  The regions are kept
+ * separately, in address order, so that whole ranges can be checked
+ * for overlap or torn down without visiting every page address. */
 struct supplemental_page_table {
+	struct hash pages;             /* Pages, by va. */
+	struct list regions;           /* Regions, by address. */
 };
 
 #include "threads/thread.h"
@@ -96,8 +151,23 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
+struct vm_region *spt_add_region (struct supplemental_page_table *spt,
+		void *start, size_t length, enum vm_region_kind kind, bool writable);
+struct vm_region *spt_find_region (struct supplemental_page_table *spt,
+		const void *va);
+bool spt_range_free (struct supplemental_page_table *spt,
+		const void *start, size_t length);
+void spt_remove_region (struct supplemental_page_table *spt,
+		struct vm_region *region);
+void vm_region_set_large (struct vm_region *region);
+bool vm_region_large (const struct vm_region *region, const void *va);
+
+extern size_t vm_fault_around;
+extern size_t vm_stack_pages;
+extern bool vm_large_pages;
 
 void vm_init (void);
+void vm_print_stats (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -106,6 +176,11 @@ bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
+void vm_release_frame (struct page *page);
+bool vm_install_page (struct page *page, const void *data);
+bool vm_region_load (struct page *page, void *aux);
+void vm_region_writeback (struct supplemental_page_table *spt,
+		struct vm_region *r, void *start, void *end);
 bool vm_claim_page (void *va);
 enum vm_type page_get_type (struct page *page);
 
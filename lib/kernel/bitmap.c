@@ -6,6 +6,7 @@
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
+#include "devices/disk.h"
 #endif
 
 /* Element type.
@@ -23,10 +24,16 @@ typedef unsigned long elem_type;
 
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   The elements from DIRTY_START up to DIRTY_END, exclusive, cover
+   every bit changed since the bitmap was last read or written,
+   so that bitmap_write_dirty() can write just those. */
 struct bitmap {
 	size_t bit_cnt;     /* Number of bits. */
 	elem_type *bits;    /* Elements that represent bits. */
+	size_t dirty_start; /* First changed element. */
+	size_t dirty_end;   /* One past last changed element. */
 };
 
 /* Returns the index of the element that contains the bit
@@ -55,6 +62,24 @@ byte_cnt (size_t bit_cnt) {
 	return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/* Records that element IDX of B has changed. */
+static inline void
+mark_dirty (struct bitmap *b, size_t idx) {
+	if (b->dirty_start >= b->dirty_end) {
+		b->dirty_start = idx;
+		b->dirty_end = idx + 1;
+	} else if (idx < b->dirty_start)
+		b->dirty_start = idx;
+	else if (idx >= b->dirty_end)
+		b->dirty_end = idx + 1;
+}
+
+/* Records that B matches its file. */
+static inline void
+mark_clean (struct bitmap *b) {
+	b->dirty_start = b->dirty_end = 0;
+}
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -62,6 +87,59 @@ last_mask (const struct bitmap *b) {
 	int last_bits = b->bit_cnt % ELEM_BITS;
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns a bit mask in which the bits of an element that
+   represent bits START through START + CNT - 1 of a bitmap are
+   set to 1 and the rest are set to 0.  The range must lie within
+   a single element. */
+static inline elem_type
+range_mask (size_t start, size_t cnt) {
+	elem_type high = (elem_type) -1 << (start % ELEM_BITS);
+	size_t end = start % ELEM_BITS + cnt;
+	return end < ELEM_BITS ? high & (((elem_type) 1 << end) - 1) : high;
+}
+
+/* Returns element IDX of B, inverted if VALUE is false, so that
+   the bits set in the result are those set to VALUE. */
+static inline elem_type
+elem_as (const struct bitmap *b, size_t idx, bool value) {
+	return value ? b->bits[idx] : ~b->bits[idx];
+}
+
+/* Returns the number of 1-bits in E.
+   The kernel is not linked with libgcc, so this cannot use
+   __builtin_popcountl(). */
+static inline size_t
+count_ones (elem_type e) {
+	e = e - ((e >> 1) & 0x5555555555555555UL);
+	e = (e & 0x3333333333333333UL) + ((e >> 2) & 0x3333333333333333UL);
+	e = (e + (e >> 4)) & 0x0f0f0f0f0f0f0f0fUL;
+	return (e * 0x0101010101010101UL) >> 56;
+}
+
+/* Returns the index of the first bit at or after START in B that
+   is set to VALUE, or the size of B if there is none.  Skips whole
+   elements at a time. */
+static size_t
+find_next (const struct bitmap *b, size_t start, bool value) {
+	size_t idx, last;
+	elem_type e;
+
+	if (start >= b->bit_cnt)
+		return b->bit_cnt;
+
+	idx = elem_idx (start);
+	last = elem_cnt (b->bit_cnt) - 1;
+	e = elem_as (b, idx, value) & ((elem_type) -1 << (start % ELEM_BITS));
+	while (e == 0) {
+		if (idx == last)
+			return b->bit_cnt;
+		e = elem_as (b, ++idx, value);
+	}
+
+	start = idx * ELEM_BITS + __builtin_ctzl (e);
+	return start < b->bit_cnt ? start : b->bit_cnt;
+}
 
 /* Creation and destruction. */
 
@@ -74,6 +152,7 @@ bitmap_create (size_t bit_cnt) {
 	struct bitmap *b = malloc (sizeof *b);
 	if (b != NULL) {
 		b->bit_cnt = bit_cnt;
+		mark_clean (b);
 		b->bits = malloc (byte_cnt (bit_cnt));
 		if (b->bits != NULL || bit_cnt == 0) {
 			bitmap_set_all (b, false);
@@ -94,6 +173,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED) {
 	ASSERT (block_size >= bitmap_buf_size (bit_cnt));
 
 	b->bit_cnt = bit_cnt;
+	mark_clean (b);
 	b->bits = (elem_type *) (b + 1);
 	bitmap_set_all (b, false);
 	return b;
@@ -148,6 +228,7 @@ bitmap_mark (struct bitmap *b, size_t bit_idx) {
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the OR instruction in [IA32-v2b]. */
 	asm ("lock orq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+	mark_dirty (b, idx);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -160,6 +241,7 @@ bitmap_reset (struct bitmap *b, size_t bit_idx) {
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the AND instruction in [IA32-v2a]. */
 	asm ("lock andq %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+	mark_dirty (b, idx);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -174,6 +256,7 @@ bitmap_flip (struct bitmap *b, size_t bit_idx) {
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the XOR instruction in [IA32-v2b]. */
 	asm ("lock xorq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+	mark_dirty (b, idx);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -211,16 +294,23 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
    exclusive, that are set to VALUE. */
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i, value_cnt;
+	size_t value_cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
+	/* Count a whole element, or what is left of one, at a time. */
 	value_cnt = 0;
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			value_cnt++;
+	while (cnt > 0) {
+		size_t n = ELEM_BITS - start % ELEM_BITS;
+		if (n > cnt)
+			n = cnt;
+		value_cnt += count_ones (elem_as (b, elem_idx (start), value)
+				& range_mask (start, n));
+		start += n;
+		cnt -= n;
+	}
 	return value_cnt;
 }
 
@@ -228,16 +318,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			return true;
-	return false;
+	return cnt > 0 && find_next (b, start, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -272,12 +357,22 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 
-	if (cnt <= b->bit_cnt) {
-		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
-				return i;
+	if (cnt == 0)
+		return start;
+
+	/* Jump from each run of VALUE bits to the end of it, and from
+	   there to the start of the next one, until a run is long
+	   enough.  Both jumps skip whole elements at a time. */
+	while (start < b->bit_cnt) {
+		size_t run_start = find_next (b, start, value);
+		size_t run_end;
+
+		if (run_start + cnt > b->bit_cnt)
+			break;
+		run_end = find_next (b, run_start, !value);
+		if (run_end - run_start >= cnt)
+			return run_start;
+		start = run_end;
 	}
 	return BITMAP_ERROR;
 }
@@ -316,15 +411,42 @@ bitmap_read (struct bitmap *b, struct file *file) {
 		success = file_read_at (file, b->bits, size, 0) == size;
 		b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
 	}
+	mark_clean (b);
 	return success;
 }
 
 /* Writes B to FILE.  Return true if successful, false
    otherwise. */
 bool
-bitmap_write (const struct bitmap *b, struct file *file) {
+bitmap_write (struct bitmap *b, struct file *file) {
+	off_t size = byte_cnt (b->bit_cnt);
+	if (file_write_at (file, b->bits, size, 0) != size)
+		return false;
+	mark_clean (b);
+	return true;
+}
+
+/* Writes to FILE only the disk sectors' worth of B that changed
+   since B was last read or written.  Returns true if successful,
+   false otherwise. */
+bool
+bitmap_write_dirty (struct bitmap *b, struct file *file) {
 	off_t size = byte_cnt (b->bit_cnt);
-	return file_write_at (file, b->bits, size, 0) == size;
+	off_t start, end;
+
+	if (b->dirty_start >= b->dirty_end)
+		return true;
+
+	start = ROUND_DOWN (b->dirty_start * sizeof (elem_type),
+			DISK_SECTOR_SIZE);
+	end = ROUND_UP (b->dirty_end * sizeof (elem_type), DISK_SECTOR_SIZE);
+	if (end > size)
+		end = size;
+	if (file_write_at (file, (uint8_t *) b->bits + start, end - start, start)
+			!= end - start)
+		return false;
+	mark_clean (b);
+	return true;
 }
 #endif /* FILESYS */
 
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+
+our ($test, @prereq_tests);
+my (@output) = read_text_file ("$test.output");
+common_checks ("replay run", @output);
+fail "Journal was not replayed at boot.\n"
+  if !grep (/^journal: replayed \d+ sectors$/, @output);
+
+my ($exp_file, $exp_length) = open_file ([random_bytes (8192)]);
+my ($act_file, $act_length) = open_file (["$prereq_tests[0].replay",
+					  0, 8192]);
+fail "Replayed file system does not hold the data written.\n"
+  if !compare_files ($exp_file, $exp_length, $act_file, $act_length,
+		     "replay", 1);
+pass;
@@ -0,0 +1,29 @@
+/* Writes a file, then lets the kernel crash part way through the
+   journal commit at shutdown (see the -jc kernel option).  The
+   persistence check boots again and reads the file back, which
+   only works if the journal replays the interrupted commit. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 8192
+
+static char buf[FILE_SIZE];
+
+void
+test_main (void)
+{
+  int fd;
+
+  CHECK (create ("scratch", 512), "create \"scratch\"");
+  CHECK (remove ("scratch"), "remove \"scratch\"");
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create ("replay", sizeof buf), "create \"replay\"");
+  CHECK ((fd = open ("replay")) > 1, "open \"replay\"");
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"replay\"");
+  msg ("close \"replay\"");
+  close (fd);
+}
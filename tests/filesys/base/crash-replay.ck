@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+fail "Kernel did not crash in the journal commit at shutdown.\n"
+  if !grep (/^journal: crashing after \d+ of \d+ sectors$/,
+	    read_text_file ("$test.output"));
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(crash-replay) begin
+(crash-replay) create "scratch"
+(crash-replay) remove "scratch"
+(crash-replay) create "replay"
+(crash-replay) open "replay"
+(crash-replay) write "replay"
+(crash-replay) close "replay"
+(crash-replay) end
+EOF
+pass;
@@ -0,0 +1,78 @@
+/* Streams a multi-megabyte file through a block-sized buffer,
+   first writing and then reading it back sequentially, and
+   checks that sector-aligned transfers cost exactly one disk
+   access per sector: no read-modify-write or zero-filling on
+   the way out and no rereads on the way back.  The file's
+   sectors are allocated while it is being written, which costs
+   a few extra accesses to the free map, the inode, and the
+   journal. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (4 * 1024 * 1024)
+#define BLOCK_SIZE (64 * 1024)
+#define SECTOR_SIZE 512
+#define METADATA_SLACK 32
+
+static const char file_name[] = "stream";
+static char buf[BLOCK_SIZE];
+
+/* Fills BUF with the contents expected at block number IDX. */
+static void
+fill_block (size_t idx)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof buf; i++)
+    buf[i] = (char) (idx * 31 + i);
+}
+
+void
+test_main (void)
+{
+  long long read_cnt, write_cnt;
+  size_t idx;
+  int fd;
+
+  CHECK (create (file_name, FILE_SIZE), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+
+  msg ("write \"%s\"", file_name);
+  read_cnt = get_fs_disk_read_cnt ();
+  write_cnt = get_fs_disk_write_cnt ();
+  for (idx = 0; idx < FILE_SIZE / BLOCK_SIZE; idx++)
+    {
+      fill_block (idx);
+      if (write (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("write %zu bytes at offset %zu failed",
+              (size_t) BLOCK_SIZE, idx * BLOCK_SIZE);
+    }
+  CHECK (get_fs_disk_read_cnt () - read_cnt <= METADATA_SLACK,
+         "check write read_cnt");
+  write_cnt = get_fs_disk_write_cnt () - write_cnt;
+  CHECK (write_cnt >= FILE_SIZE / SECTOR_SIZE
+         && write_cnt <= FILE_SIZE / SECTOR_SIZE + METADATA_SLACK,
+         "check write write_cnt");
+
+  msg ("read \"%s\"", file_name);
+  seek (fd, 0);
+  read_cnt = get_fs_disk_read_cnt ();
+  for (idx = 0; idx < FILE_SIZE / BLOCK_SIZE; idx++)
+    {
+      static char expected[BLOCK_SIZE];
+
+      if (read (fd, expected, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("read %zu bytes at offset %zu failed",
+              (size_t) BLOCK_SIZE, idx * BLOCK_SIZE);
+      fill_block (idx);
+      compare_bytes (expected, buf, BLOCK_SIZE, idx * BLOCK_SIZE, file_name);
+    }
+  CHECK (get_fs_disk_read_cnt () - read_cnt <= FILE_SIZE / SECTOR_SIZE,
+         "check read read_cnt");
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-seq-stream) begin
+(lg-seq-stream) create "stream"
+(lg-seq-stream) open "stream"
+(lg-seq-stream) write "stream"
+(lg-seq-stream) check write read_cnt
+(lg-seq-stream) check write write_cnt
+(lg-seq-stream) read "stream"
+(lg-seq-stream) check read read_cnt
+(lg-seq-stream) close "stream"
+(lg-seq-stream) end
+EOF
+pass;
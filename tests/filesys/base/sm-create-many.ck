@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(sm-create-many) begin
+(sm-create-many) create and remove 500 files
+(sm-create-many) check write_cnt
+(sm-create-many) end
+EOF
+pass;
@@ -0,0 +1,148 @@
+/* Test program for lib/kernel/bitmap.c.
+
+   Checks bitmap_scan(), bitmap_count(), and bitmap_contains()
+   against straightforward bit-by-bit versions on small random
+   bitmaps, then times bitmap_scan() and bitmap_count() on bitmaps
+   of millions of bits at several fill levels.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/test.h"
+
+/* Largest bitmap checked against the reference versions. */
+#define MAX_CHECK_BITS 300
+
+/* Size of the bitmaps used for timing. */
+#define BENCH_BITS (4 * 1024 * 1024)
+
+static void fill_random (struct bitmap *, int percent);
+static size_t ref_scan (const struct bitmap *, size_t start, size_t cnt,
+                        bool value);
+static size_t ref_count (const struct bitmap *, size_t start, size_t cnt,
+                         bool value);
+static void check (void);
+static void bench (int percent);
+
+/* Tests and times the bitmap implementation. */
+void
+test (void)
+{
+  check ();
+  bench (0);
+  bench (50);
+  bench (90);
+  bench (99);
+  printf ("done\n");
+}
+
+/* Compares the bitmap functions with the reference versions on
+   random bitmaps of up to MAX_CHECK_BITS bits. */
+static void
+check (void)
+{
+  int iter;
+
+  printf ("checking against bit-by-bit versions...");
+  for (iter = 0; iter < 1000; iter++)
+    {
+      size_t bit_cnt = random_ulong () % MAX_CHECK_BITS + 1;
+      struct bitmap *b = bitmap_create (bit_cnt);
+      int query;
+
+      ASSERT (b != NULL);
+      fill_random (b, random_ulong () % 101);
+      for (query = 0; query < 50; query++)
+        {
+          size_t start = random_ulong () % (bit_cnt + 1);
+          size_t cnt = random_ulong () % (bit_cnt - start + 1);
+          size_t run = random_ulong () % 20;
+          bool value = random_ulong () % 2;
+          size_t expected = ref_count (b, start, cnt, value);
+
+          ASSERT (bitmap_count (b, start, cnt, value) == expected);
+          ASSERT (bitmap_contains (b, start, cnt, value) == (expected > 0));
+          ASSERT (bitmap_scan (b, start, run, value)
+                  == ref_scan (b, start, run, value));
+        }
+      bitmap_destroy (b);
+    }
+  printf (" ok\n");
+}
+
+/* Times bitmap_scan() and bitmap_count() on a bitmap of
+   BENCH_BITS bits with about PERCENT percent of its bits set. */
+static void
+bench (int percent)
+{
+  struct bitmap *b = bitmap_create (BENCH_BITS);
+  int64_t start;
+  size_t found = 0, cnt;
+  int i;
+
+  ASSERT (b != NULL);
+  fill_random (b, percent);
+
+  start = timer_ticks ();
+  for (i = 0; i < 100; i++)
+    if (bitmap_scan (b, 0, 8, false) != BITMAP_ERROR)
+      found++;
+  printf ("%d%% full: 100 scans for 8 free bits: %"PRId64" ticks\n",
+          percent, timer_elapsed (start));
+
+  start = timer_ticks ();
+  for (i = 0; i < 100; i++)
+    cnt = bitmap_count (b, 0, BENCH_BITS, true);
+  printf ("%d%% full: 100 counts (%zu set): %"PRId64" ticks\n",
+          percent, cnt, timer_elapsed (start));
+
+  ASSERT (found == 0 || found == 100);
+  bitmap_destroy (b);
+}
+
+/* Sets about PERCENT percent of the bits in B, at random. */
+static void
+fill_random (struct bitmap *b, int percent)
+{
+  size_t i;
+
+  for (i = 0; i < bitmap_size (b); i++)
+    bitmap_set (b, i, (int) (random_ulong () % 100) < percent);
+}
+
+/* Bit-by-bit version of bitmap_scan(). */
+static size_t
+ref_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i, j;
+
+  for (i = start; i + cnt <= bitmap_size (b); i++)
+    {
+      for (j = 0; j < cnt; j++)
+        if (bitmap_test (b, i + j) != value)
+          break;
+      if (j == cnt)
+        return i;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Bit-by-bit version of bitmap_count(). */
+static size_t
+ref_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i, value_cnt = 0;
+
+  for (i = start; i < start + cnt; i++)
+    if (bitmap_test (b, i) == value)
+      value_cnt++;
+  return value_cnt;
+}
@@ -0,0 +1,149 @@
+/* Test program for threads/palloc.c.
+
+   Several threads allocate and free random mixes of single pages
+   and small multi-page blocks from the kernel pool, writing a
+   pattern into each allocation and checking it before freeing it,
+   then the whole pool is taken in single pages and given back to
+   check that nothing was lost and that freed blocks coalesce.
+   Reports the time each phase takes.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "threads/test.h"
+
+/* Number of stress threads. */
+#define THREAD_CNT 4
+
+/* Allocations each thread holds at once, and makes in total. */
+#define HELD_MAX 64
+#define ITER_CNT 20000
+
+struct block
+  {
+    uint8_t *pages;
+    size_t page_cnt;
+  };
+
+static struct semaphore done;
+
+static void stress_thread (void *);
+static size_t drain_pool (void);
+
+/* Stresses and times the page allocator. */
+void
+test (void)
+{
+  size_t before, after;
+  int64_t start;
+  void *page;
+  int i;
+
+  before = drain_pool ();
+  printf ("%zu free pages\n", before);
+
+  sema_init (&done, 0);
+  start = timer_ticks ();
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "stress %d", i);
+      thread_create (name, PRI_DEFAULT, stress_thread, (void *) (intptr_t) i);
+    }
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&done);
+  printf ("%d threads x %d allocations: %"PRId64" ticks\n",
+          THREAD_CNT, ITER_CNT, timer_elapsed (start));
+
+  /* Let the stress threads finish dying and free their pages. */
+  timer_sleep (10);
+
+  start = timer_ticks ();
+  after = drain_pool ();
+  printf ("%zu free pages after: %"PRId64" ticks\n",
+          after, timer_elapsed (start));
+  ASSERT (after == before);
+
+  /* With everything freed, a large block must be available. */
+  page = palloc_get_multiple (0, 64);
+  ASSERT (page != NULL);
+  palloc_free_multiple (page, 64);
+  printf ("done\n");
+}
+
+/* Allocates and frees random blocks, mostly single pages, keeping
+   up to HELD_MAX at once. */
+static void
+stress_thread (void *aux)
+{
+  static struct block held[THREAD_CNT][HELD_MAX];
+  struct block *mine = held[(intptr_t) aux];
+  size_t held_cnt = 0;
+  uint8_t tag = (intptr_t) aux + 1;
+  int iter;
+
+  for (iter = 0; iter < ITER_CNT; iter++)
+    {
+      if (held_cnt < HELD_MAX && (held_cnt == 0 || random_ulong () % 2))
+        {
+          struct block *b = &mine[held_cnt];
+          b->page_cnt = random_ulong () % 4 ? 1 : random_ulong () % 8 + 2;
+          b->pages = palloc_get_multiple (0, b->page_cnt);
+          if (b->pages == NULL)
+            continue;
+          memset (b->pages, tag, b->page_cnt * PGSIZE);
+          held_cnt++;
+        }
+      else
+        {
+          struct block *b = &mine[random_ulong () % held_cnt];
+          size_t i;
+
+          for (i = 0; i < b->page_cnt * PGSIZE; i += 512)
+            ASSERT (b->pages[i] == tag);
+          palloc_free_multiple (b->pages, b->page_cnt);
+          *b = mine[--held_cnt];
+        }
+    }
+  while (held_cnt > 0)
+    {
+      struct block *b = &mine[--held_cnt];
+      palloc_free_multiple (b->pages, b->page_cnt);
+    }
+  sema_up (&done);
+}
+
+/* Allocates every free page in the kernel pool one at a time, frees
+   them all again, and returns how many there were. */
+static size_t
+drain_pool (void)
+{
+  void *list = NULL;
+  size_t cnt = 0;
+  void *page;
+
+  while ((page = palloc_get_page (0)) != NULL)
+    {
+      *(void **) page = list;
+      list = page;
+      cnt++;
+    }
+  while (list != NULL)
+    {
+      page = list;
+      list = *(void **) page;
+      palloc_free_page (page);
+    }
+  return cnt;
+}
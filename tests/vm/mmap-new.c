@@ -0,0 +1,53 @@
+/* Creates a file, which has no data sectors until it is written
+   back, maps it, and writes to some of its pages through the
+   mapping.  Unmaps and closes the file, then reads it back with
+   the read system call to verify that the written pages kept
+   their data and the others read as zeros. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+#define SIZE (3 * 4096 + 100)
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  size_t i;
+  int handle;
+  void *map;
+
+  CHECK (create ("new.txt", SIZE), "create \"new.txt\"");
+  CHECK ((handle = open ("new.txt")) > 1, "open \"new.txt\"");
+  CHECK ((map = mmap (ACTUAL, SIZE, 1, handle, 0)) != MAP_FAILED,
+         "mmap \"new.txt\"");
+  for (i = 0; i < SIZE; i++)
+    if (ACTUAL[i] != 0)
+      fail ("byte %zu of new file is %d, not zero", i, ACTUAL[i]);
+
+  /* Leave the second page untouched. */
+  for (i = 0; i < SIZE; i++)
+    if (i / 4096 != 1)
+      ACTUAL[i] = i % 251 + 1;
+
+  msg ("munmap \"new.txt\"");
+  munmap (map);
+  msg ("close \"new.txt\"");
+  close (handle);
+
+  CHECK ((handle = open ("new.txt")) > 1, "open \"new.txt\" again");
+  CHECK (read (handle, buf, SIZE) == SIZE, "read \"new.txt\"");
+  for (i = 0; i < SIZE; i++)
+    {
+      char expected = i / 4096 != 1 ? i % 251 + 1 : 0;
+      if (buf[i] != expected)
+        fail ("byte %zu of \"new.txt\" is %d, not %d",
+              i, buf[i], expected);
+    }
+  msg ("close \"new.txt\"");
+  close (handle);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-new) begin
+(mmap-new) create "new.txt"
+(mmap-new) open "new.txt"
+(mmap-new) mmap "new.txt"
+(mmap-new) munmap "new.txt"
+(mmap-new) close "new.txt"
+(mmap-new) open "new.txt" again
+(mmap-new) read "new.txt"
+(mmap-new) close "new.txt"
+(mmap-new) end
+EOF
+pass;
@@ -20,7 +20,9 @@
 #include "threads/mmu.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
+#include "threads/vmalloc.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -36,6 +38,8 @@
 #include "devices/disk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/page_cache.h"
+#include "filesys/journal.h"
 #endif
 
 /* Page-map-level-4 with kernel mappings only. */
@@ -83,8 +87,10 @@ int main(void)
 
 	/* Initialize memory system. */
 	mem_end = palloc_init();
+	slab_init();
 	malloc_init();
 	paging_init(mem_end);
+	vmalloc_init();
 
 #ifdef USERPROG
 	tss_init();
@@ -142,7 +148,12 @@ bss_init(void)
 
 /* Populates the page table with the kernel virtual mapping,
  * and then sets up the CPU to use the new page directory.
- * Points base_pml4 to the pml4 it creates. */
+ * Points base_pml4 to the pml4 it creates.
+ *
+ * Memory is mapped with 2 MB large pages where it can be, which
+ * takes far fewer TLB entries, and 4 kB pages only around the
+ * read-only kernel text and at the end of memory.  The mappings are
+ * global, so they stay in the TLB when the page table changes. */
 static void
 paging_init(uint64_t mem_end)
 {
@@ -157,7 +168,17 @@ paging_init(uint64_t mem_end)
 	{
 		uint64_t va = (uint64_t)ptov(pa);
 
-		perm = PTE_P | PTE_W;
+		if (pa % LARGE_PGSIZE == 0 && pa + LARGE_PGSIZE <= mem_end
+			&& (va + LARGE_PGSIZE <= (uint64_t)&start
+				|| (uint64_t)&_end_kernel_text <= va))
+		{
+			if ((pte = pml4e_walk_pde(pml4, va, 1)) != NULL)
+				*pte = pa | PTE_P | PTE_W | PTE_PS | PTE_G;
+			pa += LARGE_PGSIZE - PGSIZE;
+			continue;
+		}
+
+		perm = PTE_P | PTE_W | PTE_G;
 		if ((uint64_t)&start <= va && va < (uint64_t)&_end_kernel_text)
 			perm &= ~PTE_W;
 
@@ -167,6 +188,7 @@ paging_init(uint64_t mem_end)
 
 	// reload cr3
 	pml4_activate(0);
+	pml4_tlb_init();
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -222,6 +244,8 @@ parse_options(char **argv)
 #ifdef FILESYS
 		else if (!strcmp(name, "-f"))
 			format_filesys = true;
+		else if (!strcmp(name, "-jc"))
+			journal_crash = true;
 #endif
 		else if (!strcmp(name, "-rs"))
 			random_init(atoi(value));
@@ -232,6 +256,14 @@ parse_options(char **argv)
 			user_page_limit = atoi(value);
 		else if (!strcmp(name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp(name, "-fa"))
+			vm_fault_around = atoi(value);
+		else if (!strcmp(name, "-sl"))
+			vm_stack_pages = atoi(value);
+		else if (!strcmp(name, "-lp"))
+			vm_large_pages = true;
 #endif
 		else
 			PANIC("unknown option `%s' (use -h for help)", name);
@@ -337,10 +369,18 @@ usage(void)
 		   "  -h                 Print this help message and power off.\n"
 		   "  -q                 Power off VM after actions or on panic.\n"
 		   "  -f                 Format file system disk during startup.\n"
+#ifdef FILESYS
+		   "  -jc                Crash part way through the last journal commit.\n"
+#endif
 		   "  -rs=SEED           Set random number seed to SEED.\n"
 		   "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
 		   "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+		   "  -fa=COUNT          Load up to COUNT pages per fault on a program.\n"
+		   "  -sl=COUNT          Limit user stacks to COUNT pages.\n"
+		   "  -lp                Map large zero-filled user data with 2 MB pages.\n"
 #endif
 	);
 	power_off();
@@ -353,7 +393,13 @@ void power_off(void)
 #ifdef FILESYS
 	filesys_done();
 #endif
+	power_off_unclean();
+}
 
+/* Powers down the machine without shutting down the file system,
+   as a crash would.  Used to test recovery. */
+void power_off_unclean(void)
+{
 	print_stats();
 
 	printf("Powering off...\n");
@@ -368,12 +414,20 @@ print_stats(void)
 {
 	timer_print_stats();
 	thread_print_stats();
+	palloc_print_stats();
+	slab_print_stats();
+	pml4_print_stats();
 #ifdef FILESYS
 	disk_print_stats();
+	journal_print_stats();
+	page_cache_print_stats();
 #endif
 	console_print_stats();
 	kbd_print_stats();
 #ifdef USERPROG
 	exception_print_stats();
 #endif
+#ifdef VM
+	vm_print_stats();
+#endif
 }
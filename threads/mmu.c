@@ -1,18 +1,56 @@
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Process-context identifiers (PCIDs).
+ *
+ * With CR4.PCIDE set, the low 12 bits of CR3 tag the TLB entries
+ * made through it, and loading CR3 with bit 63 set keeps the entries
+ * of every PCID instead of flushing them, so a process that runs
+ * again finds its translations still there.  Like Linux, we hand out
+ * only a few PCIDs, each to the page table that last used it, and
+ * give the least recently used one to a page table that has none,
+ * flushing what it held.  PCID 0 is base_pml4's.
+ *
+ * Entries for a page table that is not active cannot be flushed
+ * with invlpg, so a change to one takes its PCID away instead.  So
+ * does pml4_destroy(), since another page table may be created at
+ * the same address.  Kernel mappings are global, shared by every
+ * PCID, and invlpg drops them everywhere. */
+#define PCID_CNT 8                  /* PCIDs for user page tables. */
+#define CR3_NOFLUSH (1ULL << 63)    /* Keep the new PCID's entries. */
+#define CR4_PGE 0x80                /* Global pages enabled. */
+#define CR4_PCIDE 0x20000           /* PCIDs enabled. */
+#define CPUID_PCID (1 << 17)        /* CPUID 1: ECX bit for PCIDs. */
+
+static bool pcid_enabled;
+static uint64_t *pcid_owner[PCID_CNT + 1];  /* Page table using each. */
+static uint64_t pcid_used[PCID_CNT + 1];    /* When each was last used. */
+static uint64_t pcid_clock;
+
+/* Statistics. */
+static long long switch_cnt;        /* Switches to a user page table. */
+static long long switch_keep_cnt;   /* ...that kept its TLB entries. */
+static long long pcid_revoke_cnt;   /* PCIDs taken away by changes. */
+
+static void pcid_revoke (uint64_t *pml4);
+static void tlb_invalidate (uint64_t *pml4, const void *va);
+
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
 	if (pdp) {
 		uint64_t *pte = (uint64_t *) pdp[idx];
+		if ((uint64_t) pte & PTE_P && (uint64_t) pte & PTE_PS)
+			return &pdp[idx];
 		if (!((uint64_t) pte & PTE_P)) {
 			if (create) {
 				uint64_t *new_page = palloc_get_page (PAL_ZERO);
@@ -29,7 +67,7 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 }
 
 static uint64_t *
-pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
+pdpe_walk (uint64_t *pdpe, const uint64_t va, int create, bool to_pde) {
 	uint64_t *pte = NULL;
 	int idx = PDPE (va);
 	int allocated = 0;
@@ -46,7 +84,10 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
-		pte = pgdir_walk (ptov (PTE_ADDR (pdpe[idx])), va, create);
+		if (to_pde)
+			pte = (uint64_t *) ptov (PTE_ADDR (pdpe[idx]) + 8 * PDX (va));
+		else
+			pte = pgdir_walk (ptov (PTE_ADDR (pdpe[idx])), va, create);
 	}
 	if (pte == NULL && allocated) {
 		palloc_free_page ((void *) ptov (PTE_ADDR (pdpe[idx])));
@@ -55,14 +96,13 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 	return pte;
 }
 
-/* Returns the address of the page table entry for virtual
- * address VADDR in page map level 4, pml4.
- * If PML4E does not have a page table for VADDR, behavior depends
- * on CREATE.  If CREATE is true, then a new page table is
- * created and a pointer into it is returned.  Otherwise, a null
- * pointer is returned. */
-uint64_t *
-pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
+/* Returns the address of the entry for virtual address VA in
+ * page map level 4 PML4E: the page directory entry if TO_PDE
+ * is true, otherwise the page table entry, or the page directory
+ * entry if VA is in a large page.  Tables missing on the way are
+ * created if CREATE is true. */
+static uint64_t *
+pml4_walk (uint64_t *pml4e, const uint64_t va, int create, bool to_pde) {
 	uint64_t *pte = NULL;
 	int idx = PML4 (va);
 	int allocated = 0;
@@ -79,7 +119,7 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
-		pte = pdpe_walk (ptov (PTE_ADDR (pml4e[idx])), va, create);
+		pte = pdpe_walk (ptov (PTE_ADDR (pml4e[idx])), va, create, to_pde);
 	}
 	if (pte == NULL && allocated) {
 		palloc_free_page ((void *) ptov (PTE_ADDR (pml4e[idx])));
@@ -88,6 +128,28 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the address of the page table entry for virtual
+ * address VADDR in page map level 4, pml4.
+ * If VADDR is in a large page, returns its page directory entry
+ * instead, which has PTE_PS set.
+ * If PML4E does not have a page table for VADDR, behavior depends
+ * on CREATE.  If CREATE is true, then a new page table is
+ * created and a pointer into it is returned.  Otherwise, a null
+ * pointer is returned. */
+uint64_t *
+pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
+	return pml4_walk (pml4e, va, create, false);
+}
+
+/* Returns the address of the page directory entry for virtual
+ * address VA in PML4E, which maps VA's large page if it has
+ * PTE_PS set.  Missing tables above it are created if CREATE is
+ * true; otherwise a null pointer is returned. */
+uint64_t *
+pml4e_walk_pde (uint64_t *pml4e, const uint64_t va, int create) {
+	return pml4_walk (pml4e, va, create, true);
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -122,10 +184,18 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
-					pml4_index, pdp_index, i))
+		if (!(((uint64_t) pte) & PTE_P))
+			continue;
+		if (pdp[i] & PTE_PS) {
+			/* A large page: FUNC gets its page directory entry. */
+			void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+								 ((uint64_t) pdp_index << PDPESHIFT) |
+								 ((uint64_t) i << PDXSHIFT));
+			if (!func (&pdp[i], va, aux))
 				return false;
+		} else if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
+					pml4_index, pdp_index, i))
+			return false;
 	}
 	return true;
 }
@@ -169,7 +239,11 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		if (!(((uint64_t) pte) & PTE_P))
+			continue;
+		if (pdp[i] & PTE_PS)
+			palloc_free_multiple ((void *) PTE_ADDR (pte), LARGE_PGCNT);
+		else
 			pt_destroy (PTE_ADDR (pte));
 	}
 	palloc_free_page ((void *) pdp);
@@ -196,14 +270,96 @@ pml4_destroy (uint64_t *pml4) {
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
 	if (((uint64_t) pdpe) & PTE_P)
 		pdpe_destroy ((void *) PTE_ADDR (pdpe));
+	pcid_revoke (pml4);
 	palloc_free_page ((void *) pml4);
 }
 
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register.  With PCIDs, PD keeps the TLB entries it left behind if
+ * it still has its PCID. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	enum intr_level old_level;
+	unsigned i, pcid = 1;
+
+	if (!pcid_enabled) {
+		lcr3 (vtop (pml4 ? pml4 : base_pml4));
+		return;
+	}
+	if (pml4 == NULL || pml4 == base_pml4) {
+		lcr3 (vtop (base_pml4) | CR3_NOFLUSH);
+		return;
+	}
+
+	old_level = intr_disable ();
+	switch_cnt++;
+	for (i = 1; i <= PCID_CNT; i++) {
+		if (pcid_owner[i] == pml4)
+			break;
+		if (pcid_used[i] < pcid_used[pcid])
+			pcid = i;
+	}
+	pcid_used[i <= PCID_CNT ? i : pcid] = ++pcid_clock;
+	if (i <= PCID_CNT) {
+		lcr3 (vtop (pml4) | i | CR3_NOFLUSH);
+		switch_keep_cnt++;
+	} else {
+		pcid_owner[pcid] = pml4;
+		lcr3 (vtop (pml4) | pcid);
+	}
+	intr_set_level (old_level);
+}
+
+/* Enables global pages and, if the CPU has them, PCIDs.  Called by
+ * paging_init() once base_pml4 is active, as PCID 0. */
+void
+pml4_tlb_init (void) {
+	uint32_t a, b, c, d;
+
+	lcr4 (rcr4 () | CR4_PGE);
+	cpuid (1, &a, &b, &c, &d);
+	if (c & CPUID_PCID) {
+		lcr4 (rcr4 () | CR4_PCIDE);
+		pcid_enabled = true;
+	}
+}
+
+/* Takes away the PCID of PML4, if it has one, so that none of the
+ * TLB entries made through it are used again. */
+static void
+pcid_revoke (uint64_t *pml4) {
+	enum intr_level old_level;
+	unsigned i;
+
+	if (!pcid_enabled)
+		return;
+	old_level = intr_disable ();
+	for (i = 1; i <= PCID_CNT; i++)
+		if (pcid_owner[i] == pml4) {
+			pcid_owner[i] = NULL;
+			pcid_used[i] = 0;
+			pcid_revoke_cnt++;
+		}
+	intr_set_level (old_level);
+}
+
+/* Drops any TLB entry for VA made through PML4, whose entry for VA
+ * has changed. */
+static void
+tlb_invalidate (uint64_t *pml4, const void *va) {
+	if (PTE_ADDR (rcr3 ()) == vtop (pml4))
+		invlpg ((uint64_t) va);
+	else
+		pcid_revoke (pml4);
+}
+
+/* Prints TLB statistics. */
+void
+pml4_print_stats (void) {
+	if (pcid_enabled)
+		printf ("TLB: %lld address space switches, %lld kept their TLB "
+				"entries, %lld PCIDs revoked\n",
+				switch_cnt, switch_keep_cnt, pcid_revoke_cnt);
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -216,6 +372,9 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
+	if (pte && (*pte & PTE_P) && (*pte & PTE_PS))
+		return ptov (PTE_ADDR (*pte))
+			+ ((uint64_t) uaddr & (LARGE_PGSIZE - 1));
 	if (pte && (*pte & PTE_P))
 		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
 	return NULL;
@@ -238,14 +397,44 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, 1);
 
-	if (pte)
+	ASSERT (pte == NULL || (*pte & PTE_PS) == 0);
+	if (pte) {
+		bool was_present = (*pte & PTE_P) != 0;
+
 		*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+		if (was_present)
+			tlb_invalidate (pml4, upage);
+	}
 	return pte != NULL;
 }
 
+/* Adds a mapping in PML4 from the large page at user virtual
+ * address UPAGE to the LARGE_PGCNT physically contiguous frames at
+ * kernel virtual address KPAGE.  Both must be LARGE_PGSIZE aligned,
+ * and nothing in UPAGE's large page may be mapped, not even through
+ * an empty page table.  If RW is true, the page is read/write;
+ * otherwise it is read-only.  Returns true if successful, false if
+ * memory allocation failed. */
+bool
+pml4_set_large_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	ASSERT ((uint64_t) upage % LARGE_PGSIZE == 0);
+	ASSERT (vtop (kpage) % LARGE_PGSIZE == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	uint64_t *pde = pml4e_walk_pde (pml4, (uint64_t) upage, 1);
+
+	if (pde) {
+		ASSERT ((*pde & PTE_P) == 0);
+		*pde = vtop (kpage) | PTE_P | PTE_PS | (rw ? PTE_W : 0) | PTE_U;
+	}
+	return pde != NULL;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
- * bits in the page table entry are preserved.
+ * bits in the page table entry are preserved.  If UPAGE is in a
+ * large page, the whole large page is marked.
  * UPAGE need not be mapped. */
 void
 pml4_clear_page (uint64_t *pml4, void *upage) {
@@ -257,8 +446,7 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+		tlb_invalidate (pml4, upage);
 	}
 }
 
@@ -283,8 +471,7 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 		else
 			*pte &= ~(uint32_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_invalidate (pml4, vpage);
 	}
 }
 
@@ -309,7 +496,9 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		else
 			*pte &= ~(uint32_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
+		/* A stale TLB entry only keeps the CPU from setting the bit
+		 * again for a while, so other page tables keep their PCIDs. */
+		if (PTE_ADDR (rcr3 ()) == vtop (pml4))
 			invlpg ((uint64_t) vpage);
 	}
 }
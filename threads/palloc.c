@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -24,15 +25,77 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Within a pool, free pages are managed by a binary buddy
+   allocator.  Free memory is kept as blocks of 2**K pages, for
+   each "order" K up to MAX_ORDER, aligned to their size relative
+   to the pool's base, on one free list per order.  An allocation
+   takes a block of the smallest sufficient order, splitting a
+   larger one if needed, and returns the pages it does not need;
+   a freed block is merged with its "buddy", the other half of the
+   block of the next order up, for as long as that buddy is free
+   too.  Both take O(log n) steps.  The free lists are threaded
+   through per-page arrays rather than through the free pages
+   themselves, so free memory is never touched.
+
+   Single pages, by far the most common request, are served from
+   a small per-CPU cache of free pages that needs no lock, only
+   interrupts off, and that is refilled from and drained to the
+   buddy allocator PCP_BATCH pages at a time.  This machine has a
+   single CPU, so there is one cache per pool.
+
+   The idle thread zeroes free pages in the background, taking
+   them from the cache, and keeps up to ZERO_MAX of them per pool
+   on a separate list, so that palloc_get_page(PAL_ZERO) usually
+   need not zero a page itself.
+
+   The used_map records which pages are handed out, for checking
+   that frees are valid. */
+
+/* Largest block order: 2**MAX_ORDER pages. */
+#define MAX_ORDER 18
+
+/* Marks a page that does not start a free block, and the end of a
+   free list. */
+#define NOT_HEAD UINT8_MAX
+#define NIL UINT32_MAX
+
+/* Per-CPU page cache: capacity, and pages moved at a time. */
+#define PCP_MAX 64
+#define PCP_BATCH 16
+
+/* Most pages to keep zeroed, per pool. */
+#define ZERO_MAX 128
 
 /* A memory pool. */
 struct pool {
 	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+	size_t page_cnt;                /* Number of pages in pool. */
+
+	/* Buddy allocator, protected by LOCK.  Per page: */
+	uint8_t *order;                 /* Order of block it starts, or NOT_HEAD. */
+	uint32_t *next, *prev;          /* Free list links, as page indexes. */
+	uint32_t free_list[MAX_ORDER + 1]; /* First block of each order. */
+
+	/* Per-CPU cache, protected by turning interrupts off. */
+	uint32_t pcp[PCP_MAX];          /* Indexes of cached free pages. */
+	size_t pcp_cnt;                 /* Number of cached pages. */
+	void *deferred;                 /* Pages freed while the cache was
+	                                   full and the lock unavailable. */
+
+	/* Pages zeroed by the idle thread, linked through their first
+	   word.  Protected by turning interrupts off. */
+	void *zeroed;
+	size_t zeroed_cnt;
 };
 
+/* PAL_ZERO single-page allocations served from, and not from, the
+   zeroed pages. */
+static long long zero_hits, zero_misses;
+
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
@@ -42,6 +105,13 @@ static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void release_deferred (struct pool *);
+static size_t pcp_get (struct pool *);
+static void pcp_put (struct pool *, size_t page_idx);
+static void pcp_drain (struct pool *);
+static size_t zeroed_get (struct pool *);
 
 /* multiboot info */
 struct multiboot_info {
@@ -224,11 +294,13 @@ split:
 			if ((uint64_t) pool_end < end) {
 				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
 				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				buddy_free (pool, page_idx, page_cnt);
 				start = (uint64_t) pool_end;
 				goto split;
 			} else {
 				page_cnt = ((uint64_t) end - start) / PGSIZE;
 				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				buddy_free (pool, page_idx, page_cnt);
 			}
 		}
 	}
@@ -262,12 +334,39 @@ palloc_init (void) {
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
-
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
+	size_t page_idx;
 	void *pages;
 
+	if (page_cnt == 1) {
+		page_idx = BITMAP_ERROR;
+		if (flags & PAL_ZERO) {
+			page_idx = zeroed_get (pool);
+			if (page_idx != BITMAP_ERROR) {
+				flags &= ~PAL_ZERO;
+				zero_hits++;
+			}
+		}
+		if (page_idx == BITMAP_ERROR)
+			page_idx = pcp_get (pool);
+		if (page_idx == BITMAP_ERROR)
+			page_idx = zeroed_get (pool);
+		else if (flags & PAL_ZERO)
+			zero_misses++;
+	} else {
+		lock_acquire (&pool->lock);
+		release_deferred (pool);
+		page_idx = buddy_alloc (pool, page_cnt);
+		if (page_idx == BITMAP_ERROR) {
+			/* The pages we need may be sitting in the cache or
+			   among the zeroed pages. */
+			pcp_drain (pool);
+			page_idx = buddy_alloc (pool, page_cnt);
+		}
+		if (page_idx != BITMAP_ERROR)
+			bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+		lock_release (&pool->lock);
+	}
+
 	if (page_idx != BITMAP_ERROR)
 		pages = pool->base + PGSIZE * page_idx;
 	else
@@ -284,6 +383,53 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	return pages;
 }
 
+/* Like palloc_get_multiple(), but the PAGE_CNT pages obtained
+   start at a physical address that is a multiple of ALIGN pages,
+   which must be a power of two.  Buddy blocks are only aligned
+   relative to the start of the pool, so unless that is aligned
+   too, enough pages are taken to contain an aligned run and the
+   rest are given back. */
+void *
+palloc_get_aligned (enum palloc_flags flags, size_t page_cnt, size_t align) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t page_idx, take_cnt, skip;
+	void *pages = NULL;
+
+	ASSERT (align > 0 && (align & (align - 1)) == 0);
+
+	skip = pg_no (vtop (pool->base)) & (align - 1);
+	take_cnt = skip == 0 && page_cnt % align == 0
+		? page_cnt : page_cnt + align - 1;
+
+	lock_acquire (&pool->lock);
+	release_deferred (pool);
+	page_idx = buddy_alloc (pool, take_cnt);
+	if (page_idx == BITMAP_ERROR) {
+		pcp_drain (pool);
+		page_idx = buddy_alloc (pool, take_cnt);
+	}
+	if (page_idx != BITMAP_ERROR) {
+		/* Keep the first aligned run, free what is around it. */
+		size_t first = ROUND_UP (page_idx + skip, align) - skip;
+
+		buddy_free (pool, page_idx, first - page_idx);
+		buddy_free (pool, first + page_cnt,
+				page_idx + take_cnt - first - page_cnt);
+		bitmap_set_multiple (pool->used_map, first, page_cnt, true);
+		pages = pool->base + PGSIZE * first;
+	}
+	lock_release (&pool->lock);
+
+	if (pages) {
+		if (flags & PAL_ZERO)
+			memset (pages, 0, PGSIZE * page_cnt);
+	} else {
+		if (flags & PAL_ASSERT)
+			PANIC ("palloc_get: out of pages");
+	}
+	return pages;
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -318,8 +464,16 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 #ifndef NDEBUG
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
+	if (page_cnt == 1) {
+		pcp_put (pool, page_idx);
+		return;
+	}
+
+	lock_acquire (&pool->lock);
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
 	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	buddy_free (pool, page_idx, page_cnt);
+	lock_release (&pool->lock);
 }
 
 /* Frees the page at PAGE. */
@@ -331,22 +485,351 @@ palloc_free_page (void *page) {
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
+  /* We'll put the pool's used_map at its base, followed by the
+     buddy allocator's per-page arrays.
+     Calculate the space needed for them
      and subtract it from the pool's size. */
 	uint64_t pgcnt = (end - start) / PGSIZE;
-	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
+	size_t bm_size = ROUND_UP (bitmap_buf_size (pgcnt), sizeof (uint32_t));
+	size_t bm_pages = DIV_ROUND_UP (bm_size
+			+ pgcnt * (2 * sizeof (uint32_t) + sizeof (uint8_t)), PGSIZE) * PGSIZE;
+	uint8_t *meta = (uint8_t *) *bm_base + bm_size;
+	int k;
 
 	lock_init(&p->lock);
-	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
+	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_size);
 	p->base = (void *) start;
+	p->page_cnt = pgcnt;
 
 	// Mark all to unusable.
 	bitmap_set_all(p->used_map, true);
 
+	// No free blocks yet.
+	p->next = (uint32_t *) meta;
+	p->prev = p->next + pgcnt;
+	p->order = (uint8_t *) (p->prev + pgcnt);
+	memset (p->order, NOT_HEAD, pgcnt);
+	for (k = 0; k <= MAX_ORDER; k++)
+		p->free_list[k] = NIL;
+	p->pcp_cnt = 0;
+	p->deferred = NULL;
+	p->zeroed = NULL;
+	p->zeroed_cnt = 0;
+
 	*bm_base += bm_pages;
 }
 
+/* Buddy allocator. */
+
+/* Adds the block of order K at page index IDX in POOL to its free
+   list.  The block goes at the front only if it is lower than the
+   current first block, so that allocations favor low addresses;
+   in particular, pages allocated before paging_init() must lie in
+   the memory mapped at boot. */
+static void
+block_insert (struct pool *pool, size_t idx, int k) {
+	uint32_t head = pool->free_list[k];
+
+	pool->order[idx] = k;
+	if (head == NIL || idx < head) {
+		pool->prev[idx] = NIL;
+		pool->next[idx] = head;
+		if (head != NIL)
+			pool->prev[head] = idx;
+		pool->free_list[k] = idx;
+	} else {
+		pool->prev[idx] = head;
+		pool->next[idx] = pool->next[head];
+		if (pool->next[head] != NIL)
+			pool->prev[pool->next[head]] = idx;
+		pool->next[head] = idx;
+	}
+}
+
+/* Removes the free block at page index IDX in POOL from its free
+   list. */
+static void
+block_remove (struct pool *pool, size_t idx) {
+	int k = pool->order[idx];
+
+	ASSERT (k != NOT_HEAD);
+	if (pool->prev[idx] != NIL)
+		pool->next[pool->prev[idx]] = pool->next[idx];
+	else
+		pool->free_list[k] = pool->next[idx];
+	if (pool->next[idx] != NIL)
+		pool->prev[pool->next[idx]] = pool->prev[idx];
+	pool->order[idx] = NOT_HEAD;
+}
+
+/* Frees the block of order K at page index IDX in POOL, merging
+   it with its buddy for as long as the buddy is free. */
+static void
+free_block (struct pool *pool, size_t idx, int k) {
+	while (k < MAX_ORDER) {
+		size_t buddy = idx ^ ((size_t) 1 << k);
+		if (buddy + ((size_t) 1 << k) > pool->page_cnt
+				|| pool->order[buddy] != k)
+			break;
+		block_remove (pool, buddy);
+		if (buddy < idx)
+			idx = buddy;
+		k++;
+	}
+	block_insert (pool, idx, k);
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first, or BITMAP_ERROR if not possible.
+   The caller must hold POOL's lock. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt) {
+	size_t idx;
+	int k = 0, j;
+
+	ASSERT (lock_held_by_current_thread (&pool->lock));
+
+	while (((size_t) 1 << k) < page_cnt)
+		if (++k > MAX_ORDER)
+			return BITMAP_ERROR;
+
+	/* Take the smallest free block big enough, and split off and
+	   free its upper halves until it is of order K. */
+	for (j = k; j <= MAX_ORDER && pool->free_list[j] == NIL; j++)
+		continue;
+	if (j > MAX_ORDER)
+		return BITMAP_ERROR;
+	idx = pool->free_list[j];
+	block_remove (pool, idx);
+	while (j > k) {
+		j--;
+		block_insert (pool, idx + ((size_t) 1 << j), j);
+	}
+
+	/* Give back the pages beyond PAGE_CNT. */
+	if (page_cnt < ((size_t) 1 << k))
+		buddy_free (pool, idx + page_cnt, ((size_t) 1 << k) - page_cnt);
+	return idx;
+}
+
+/* Frees the PAGE_CNT pages starting at page index IDX in POOL, as
+   the largest aligned blocks they can be split into.
+   The caller must hold POOL's lock, except during
+   initialization. */
+static void
+buddy_free (struct pool *pool, size_t idx, size_t page_cnt) {
+	while (page_cnt > 0) {
+		int k = 0;
+		while (k < MAX_ORDER
+				&& (idx & ((size_t) 1 << k)) == 0
+				&& ((size_t) 2 << k) <= page_cnt)
+			k++;
+		free_block (pool, idx, k);
+		idx += (size_t) 1 << k;
+		page_cnt -= (size_t) 1 << k;
+	}
+}
+
+/* Returns to the buddy allocator the pages that pcp_put() could
+   neither cache nor free.  Each such page holds a pointer to the
+   next one.  The caller must hold POOL's lock. */
+static void
+release_deferred (struct pool *pool) {
+	while (pool->deferred != NULL) {
+		enum intr_level old_level = intr_disable ();
+		void *page = pool->deferred;
+		pool->deferred = page != NULL ? *(void **) page : NULL;
+		intr_set_level (old_level);
+		if (page != NULL)
+			free_block (pool, pg_no (page) - pg_no (pool->base), 0);
+	}
+}
+
+/* Per-CPU page cache. */
+
+/* Returns the index of a free page from POOL's cache, refilling it
+   from the buddy allocator first if it is empty, or BITMAP_ERROR if
+   POOL has no free pages. */
+static size_t
+pcp_get (struct pool *pool) {
+	enum intr_level old_level;
+	size_t idx = BITMAP_ERROR;
+
+	old_level = intr_disable ();
+	if (pool->pcp_cnt == 0) {
+		intr_set_level (old_level);
+
+		lock_acquire (&pool->lock);
+		release_deferred (pool);
+		for (;;) {
+			size_t page = buddy_alloc (pool, 1);
+			bool cached = false;
+
+			if (page == BITMAP_ERROR)
+				break;
+			old_level = intr_disable ();
+			if (pool->pcp_cnt < PCP_BATCH) {
+				pool->pcp[pool->pcp_cnt++] = page;
+				cached = true;
+			}
+			intr_set_level (old_level);
+			if (!cached) {
+				free_block (pool, page, 0);
+				break;
+			}
+		}
+		lock_release (&pool->lock);
+
+		old_level = intr_disable ();
+	}
+	if (pool->pcp_cnt > 0) {
+		idx = pool->pcp[--pool->pcp_cnt];
+		ASSERT (!bitmap_test (pool->used_map, idx));
+		bitmap_mark (pool->used_map, idx);
+	}
+	intr_set_level (old_level);
+	return idx;
+}
+
+/* Puts the free page at index IDX into POOL's cache.  If the cache
+   is full, first returns PCP_BATCH pages from it to the buddy
+   allocator.  May be called with interrupts off, as when
+   do_schedule() frees a dying thread's page.  Releasing the lock
+   could then yield from inside the scheduler, so the lock is not
+   taken at all: the page is set aside for the next allocation to
+   release instead. */
+static void
+pcp_put (struct pool *pool, size_t idx) {
+	enum intr_level old_level = intr_disable ();
+	uint32_t batch[PCP_BATCH];
+	size_t batch_cnt = 0;
+
+	ASSERT (bitmap_test (pool->used_map, idx));
+	bitmap_reset (pool->used_map, idx);
+	if (pool->pcp_cnt < PCP_MAX) {
+		pool->pcp[pool->pcp_cnt++] = idx;
+		intr_set_level (old_level);
+		return;
+	}
+
+	if (old_level == INTR_OFF) {
+		void *page = pool->base + idx * PGSIZE;
+		*(void **) page = pool->deferred;
+		pool->deferred = page;
+		return;
+	}
+
+	while (batch_cnt < PCP_BATCH)
+		batch[batch_cnt++] = pool->pcp[--pool->pcp_cnt];
+	pool->pcp[pool->pcp_cnt++] = idx;
+	intr_set_level (old_level);
+
+	lock_acquire (&pool->lock);
+	while (batch_cnt > 0)
+		free_block (pool, batch[--batch_cnt], 0);
+	lock_release (&pool->lock);
+}
+
+/* Returns all the pages in POOL's cache, and its zeroed pages, to
+   the buddy allocator.  The caller must hold POOL's lock. */
+static void
+pcp_drain (struct pool *pool) {
+	ASSERT (lock_held_by_current_thread (&pool->lock));
+
+	for (;;) {
+		enum intr_level old_level = intr_disable ();
+		size_t idx = pool->pcp_cnt > 0 ? pool->pcp[--pool->pcp_cnt] : NIL;
+		if (idx == NIL && pool->zeroed != NULL) {
+			void *page = pool->zeroed;
+			pool->zeroed = *(void **) page;
+			pool->zeroed_cnt--;
+			idx = pg_no (page) - pg_no (pool->base);
+		}
+		intr_set_level (old_level);
+		if (idx == NIL)
+			break;
+		free_block (pool, idx, 0);
+	}
+}
+
+/* Zeroed pages. */
+
+/* Returns the index of a zeroed free page from POOL, or
+   BITMAP_ERROR if it has none. */
+static size_t
+zeroed_get (struct pool *pool) {
+	enum intr_level old_level = intr_disable ();
+	void *page = pool->zeroed;
+	size_t idx = BITMAP_ERROR;
+
+	if (page != NULL) {
+		pool->zeroed = *(void **) page;
+		pool->zeroed_cnt--;
+		*(void **) page = NULL;
+		idx = pg_no (page) - pg_no (pool->base);
+		ASSERT (!bitmap_test (pool->used_map, idx));
+		bitmap_mark (pool->used_map, idx);
+	}
+	intr_set_level (old_level);
+	return idx;
+}
+
+/* Zeroes one free page, for a pool that has fewer than ZERO_MAX
+   zeroed pages, preferring recently freed pages from the cache.
+   Returns true if it did, false if there is nothing to do.
+
+   Called by the idle thread, which must never block, so the pool
+   lock is only tried.  It is taken with interrupts on, since
+   releasing it may yield to a thread it woke up. */
+bool
+palloc_zero_idle (void) {
+	struct pool *pools[] = { &kernel_pool, &user_pool };
+	size_t i;
+
+	ASSERT (intr_get_level () == INTR_ON);
+
+	for (i = 0; i < sizeof pools / sizeof *pools; i++) {
+		struct pool *pool = pools[i];
+		enum intr_level old_level;
+		size_t idx = NIL;
+		void *page;
+
+		if (pool->zeroed_cnt >= ZERO_MAX)
+			continue;
+
+		old_level = intr_disable ();
+		if (pool->pcp_cnt > 0)
+			idx = pool->pcp[--pool->pcp_cnt];
+		intr_set_level (old_level);
+		if (idx == NIL && lock_try_acquire (&pool->lock)) {
+			idx = buddy_alloc (pool, 1);
+			if (idx == BITMAP_ERROR)
+				idx = NIL;
+			lock_release (&pool->lock);
+		}
+		if (idx == NIL)
+			continue;
+
+		page = pool->base + idx * PGSIZE;
+		memset (page, 0, PGSIZE);
+
+		old_level = intr_disable ();
+		*(void **) page = pool->zeroed;
+		pool->zeroed = page;
+		pool->zeroed_cnt++;
+		intr_set_level (old_level);
+		return true;
+	}
+	return false;
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	printf ("Palloc: %lld zeroed page hits, %lld misses\n",
+			zero_hits, zero_misses);
+}
+
 /* Returns true if PAGE was allocated from POOL,
    false otherwise. */
 static bool
@@ -0,0 +1,347 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A slab allocator.
+
+   Each object cache hands out objects of one exact size, rounded
+   up only to OBJ_ALIGN.  Its objects are carved out of "slabs",
+   single pages obtained from the page allocator, each of which
+   begins with a header that records the owning cache and a stack
+   of the indexes of the slab's free objects.  Keeping the free
+   list outside the objects lets a cache have a constructor: it is
+   run once, when an object's slab is created, and a freed object
+   is expected to be back in its constructed state, so that
+   allocating it again costs nothing.
+
+   A cache keeps its slabs on three lists, by whether all, some,
+   or none of their objects are free.  Allocation takes from a
+   partly used slab first so that empty slabs can be given back
+   to the page allocator; a cache keeps at most one empty slab in
+   reserve.  The space left over after the objects in a slab is
+   used to "color" it, starting the objects at a different offset
+   in successive slabs so that they do not all compete for the
+   same cache lines.
+
+   In front of the slab lists, each cache has a per-CPU
+   "magazine" of up to MAG_SIZE free objects, protected only by
+   turning interrupts off, that most allocations and frees hit
+   without taking the cache's lock.  It is refilled from and
+   flushed to the slabs MAG_BATCH objects at a time.  This
+   machine has a single CPU, so there is one magazine per cache.
+
+   Caches are themselves allocated from a cache, cache_cache. */
+
+/* Alignment of objects. */
+#define OBJ_ALIGN 8
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab0bec
+
+/* Magazine capacity, and objects moved at a time. */
+#define MAG_SIZE 16
+#define MAG_BATCH (MAG_SIZE / 2)
+
+/* Object cache. */
+struct kmem_cache {
+	char name[16];              /* Name, for statistics. */
+	size_t size;                /* Object size, as requested. */
+	size_t stride;              /* Object size, rounded up. */
+	size_t per_slab;            /* Objects per slab. */
+	size_t offset;              /* Offset of first object in a slab. */
+	size_t color_max;           /* Largest color offset. */
+	size_t color_next;          /* Color offset of next slab. */
+	kmem_ctor *ctor;            /* Constructor, or null. */
+	struct list_elem elem;      /* Element in cache_list. */
+
+	/* Protected by LOCK. */
+	struct lock lock;           /* Mutual exclusion. */
+	struct list full;           /* Slabs with no free objects. */
+	struct list partial;        /* Slabs with some free objects. */
+	struct list empty;          /* Slabs with only free objects. */
+	size_t slab_cnt;            /* Number of slabs. */
+	size_t slab_free_cnt;       /* Free objects in slabs. */
+
+	/* Per-CPU magazine, protected by turning interrupts off. */
+	void *mag[MAG_SIZE];        /* Free objects. */
+	size_t mag_cnt;             /* Number of objects in MAG. */
+	long long alloc_cnt;        /* Allocations. */
+	long long mag_hit_cnt;      /* Allocations served by MAG. */
+};
+
+/* Slab header, at the start of a slab's page. */
+struct slab {
+	unsigned magic;             /* Always set to SLAB_MAGIC. */
+	struct kmem_cache *cache;   /* Owning cache. */
+	struct list_elem elem;      /* Element in one of the cache's lists. */
+	uint8_t *objs;              /* First object. */
+	size_t free_cnt;            /* Number of free objects. */
+	uint16_t free[];            /* Indexes of free objects. */
+};
+
+/* Cache of caches. */
+static struct kmem_cache cache_cache;
+
+/* All caches, for statistics. */
+static struct list cache_list;
+
+static void cache_init (struct kmem_cache *, const char *name, size_t size,
+		kmem_ctor *);
+static void *slab_alloc (struct kmem_cache *);
+static void slab_free (struct kmem_cache *, void *);
+
+/* Initializes the slab allocator. */
+void
+slab_init (void) {
+	list_init (&cache_list);
+	cache_init (&cache_cache, "kmem_cache", sizeof (struct kmem_cache), NULL);
+}
+
+/* Creates and returns a cache of SIZE-byte objects named NAME,
+   each of which is passed to CTOR, if nonnull, when it is first
+   created.  Returns a null pointer if memory is not available. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, kmem_ctor *ctor) {
+	struct kmem_cache *c = kmem_cache_alloc (&cache_cache);
+	if (c != NULL)
+		cache_init (c, name, size, ctor);
+	return c;
+}
+
+/* Initializes cache C of SIZE-byte objects named NAME, with
+   constructor CTOR, and adds it to cache_list. */
+static void
+cache_init (struct kmem_cache *c, const char *name, size_t size,
+		kmem_ctor *ctor) {
+	enum intr_level old_level;
+	size_t n;
+
+	ASSERT (size > 0);
+
+	strlcpy (c->name, name, sizeof c->name);
+	c->size = size;
+	c->stride = ROUND_UP (size, OBJ_ALIGN);
+	c->ctor = ctor;
+
+	/* Fit as many objects as possible after the header. */
+	for (n = PGSIZE / c->stride; n > 0; n--) {
+		size_t offset = ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+				OBJ_ALIGN);
+		if (offset + n * c->stride <= PGSIZE) {
+			c->per_slab = n;
+			c->offset = offset;
+			break;
+		}
+	}
+	ASSERT (n > 0);
+	c->color_max = PGSIZE - c->offset - c->per_slab * c->stride;
+	c->color_next = 0;
+
+	lock_init (&c->lock);
+	list_init (&c->full);
+	list_init (&c->partial);
+	list_init (&c->empty);
+	c->slab_cnt = c->slab_free_cnt = 0;
+	c->mag_cnt = 0;
+	c->alloc_cnt = c->mag_hit_cnt = 0;
+
+	old_level = intr_disable ();
+	list_push_back (&cache_list, &c->elem);
+	intr_set_level (old_level);
+}
+
+/* Obtains and returns an object from cache C.
+   Returns a null pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c) {
+	enum intr_level old_level;
+	void *batch[MAG_BATCH];
+	size_t batch_cnt = 0;
+	void *obj = NULL;
+
+	old_level = intr_disable ();
+	c->alloc_cnt++;
+	if (c->mag_cnt > 0) {
+		obj = c->mag[--c->mag_cnt];
+		c->mag_hit_cnt++;
+	}
+	intr_set_level (old_level);
+	if (obj != NULL)
+		return obj;
+
+	/* Take an object, and a batch more for the magazine. */
+	lock_acquire (&c->lock);
+	obj = slab_alloc (c);
+	while (obj != NULL && batch_cnt < MAG_BATCH) {
+		void *extra = slab_alloc (c);
+		if (extra == NULL)
+			break;
+		batch[batch_cnt++] = extra;
+	}
+
+	old_level = intr_disable ();
+	while (batch_cnt > 0 && c->mag_cnt < MAG_SIZE)
+		c->mag[c->mag_cnt++] = batch[--batch_cnt];
+	intr_set_level (old_level);
+
+	while (batch_cnt > 0)
+		slab_free (c, batch[--batch_cnt]);
+	lock_release (&c->lock);
+	return obj;
+}
+
+/* Returns OBJ, which must have been obtained from cache C, to C. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj) {
+	enum intr_level old_level;
+	void *batch[MAG_BATCH];
+	size_t batch_cnt = 0;
+
+	if (obj == NULL)
+		return;
+	ASSERT (kmem_cache_of (obj) == c);
+
+#ifndef NDEBUG
+	/* Clear the object to help detect use-after-free bugs, unless
+	   it must keep its constructed state. */
+	if (c->ctor == NULL)
+		memset (obj, 0xcc, c->size);
+#endif
+
+	old_level = intr_disable ();
+	if (c->mag_cnt == MAG_SIZE)
+		while (batch_cnt < MAG_BATCH)
+			batch[batch_cnt++] = c->mag[--c->mag_cnt];
+	c->mag[c->mag_cnt++] = obj;
+	intr_set_level (old_level);
+
+	if (batch_cnt > 0) {
+		lock_acquire (&c->lock);
+		while (batch_cnt > 0)
+			slab_free (c, batch[--batch_cnt]);
+		lock_release (&c->lock);
+	}
+}
+
+/* Returns the cache that OBJ belongs to, or a null pointer if OBJ
+   is not in a slab. */
+struct kmem_cache *
+kmem_cache_of (const void *obj) {
+	const struct slab *s = pg_round_down (obj);
+	return s->magic == SLAB_MAGIC ? s->cache : NULL;
+}
+
+/* Returns the size of the objects in cache C. */
+size_t
+kmem_cache_size (const struct kmem_cache *c) {
+	return c->size;
+}
+
+/* Takes a free object from one of C's slabs, creating a new slab
+   if none has any.  Returns a null pointer if memory is not
+   available.  The caller must hold C's lock. */
+static void *
+slab_alloc (struct kmem_cache *c) {
+	struct slab *s;
+
+	ASSERT (lock_held_by_current_thread (&c->lock));
+
+	if (!list_empty (&c->partial))
+		s = list_entry (list_front (&c->partial), struct slab, elem);
+	else if (!list_empty (&c->empty)) {
+		s = list_entry (list_pop_front (&c->empty), struct slab, elem);
+		list_push_front (&c->partial, &s->elem);
+	} else {
+		size_t i;
+
+		s = palloc_get_page (0);
+		if (s == NULL)
+			return NULL;
+		s->magic = SLAB_MAGIC;
+		s->cache = c;
+		s->objs = (uint8_t *) s + c->offset + c->color_next;
+		c->color_next += OBJ_ALIGN;
+		if (c->color_next > c->color_max)
+			c->color_next = 0;
+		s->free_cnt = c->per_slab;
+		for (i = 0; i < c->per_slab; i++) {
+			s->free[i] = c->per_slab - 1 - i;
+			if (c->ctor != NULL)
+				c->ctor (s->objs + i * c->stride);
+		}
+		list_push_front (&c->partial, &s->elem);
+		c->slab_cnt++;
+		c->slab_free_cnt += c->per_slab;
+	}
+
+	c->slab_free_cnt--;
+	if (--s->free_cnt == 0) {
+		list_remove (&s->elem);
+		list_push_front (&c->full, &s->elem);
+	}
+	return s->objs + s->free[s->free_cnt] * c->stride;
+}
+
+/* Returns OBJ to its slab in C, and the slab to the page allocator
+   if it is now empty and C already has an empty slab.  The caller
+   must hold C's lock. */
+static void
+slab_free (struct kmem_cache *c, void *obj) {
+	struct slab *s = pg_round_down (obj);
+	size_t ofs = (uint8_t *) obj - s->objs;
+
+	ASSERT (lock_held_by_current_thread (&c->lock));
+	ASSERT (s->magic == SLAB_MAGIC && s->cache == c);
+	ASSERT (ofs % c->stride == 0 && ofs / c->stride < c->per_slab);
+	ASSERT (s->free_cnt < c->per_slab);
+
+	s->free[s->free_cnt] = ofs / c->stride;
+	c->slab_free_cnt++;
+	if (s->free_cnt++ == 0) {
+		list_remove (&s->elem);
+		list_push_front (&c->partial, &s->elem);
+	}
+	if (s->free_cnt == c->per_slab) {
+		list_remove (&s->elem);
+		if (list_empty (&c->empty))
+			list_push_front (&c->empty, &s->elem);
+		else {
+			s->magic = 0;
+			palloc_free_page (s);
+			c->slab_cnt--;
+			c->slab_free_cnt -= c->per_slab;
+		}
+	}
+}
+
+/* Prints the usage of each cache that has been used: objects in
+   use out of those in its slabs, and the percentage of its slabs'
+   memory not holding objects in use. */
+void
+slab_print_stats (void) {
+	struct list_elem *e;
+
+	for (e = list_begin (&cache_list); e != list_end (&cache_list);
+			e = list_next (e)) {
+		struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+		size_t total = c->slab_cnt * c->per_slab;
+		size_t used = total - c->slab_free_cnt - c->mag_cnt;
+		size_t bytes = c->slab_cnt * PGSIZE;
+
+		if (c->alloc_cnt == 0)
+			continue;
+		printf ("Slab: %s: %zu of %zu %zu-byte objects in use, "
+				"%zu slabs, %zu%% wasted, %lld allocs, %lld from magazine\n",
+				c->name, used, total, c->size, c->slab_cnt,
+				bytes > 0 ? (bytes - used * c->size) * 100 / bytes : 0,
+				c->alloc_cnt, c->mag_hit_cnt);
+	}
+}
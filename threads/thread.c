@@ -16,6 +16,9 @@
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
+#ifdef FILESYS
+#include "filesys/inode.h"
+#endif
 
 /* Random value for struct thread's `magic' member.
    Used to detect stack overflow.  See the big comment at the top
@@ -319,6 +322,9 @@ void thread_exit(void)
 #ifdef USERPROG
 	process_exit();
 #endif
+#ifdef FILESYS
+	inode_release_bounce();
+#endif
 
 	/* Just set our status to dying and schedule another process.
 	   We will be destroyed during the call to schedule_tail(). */
@@ -418,6 +424,12 @@ idle(void *idle_started_ UNUSED)
 
 	for (;;)
 	{
+		/* Zero free pages while there is nothing else to do, one
+		   at a time.  A thread made ready by an interrupt does not
+		   preempt us, so check for one before each page. */
+		while (list_empty(&ready_list) && palloc_zero_idle())
+			continue;
+
 		/* Let someone else run. */
 		intr_disable();
 		thread_block();
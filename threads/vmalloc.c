@@ -0,0 +1,146 @@
+#include "threads/vmalloc.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+/* Virtually contiguous allocations.
+
+   vmalloc() gathers as many pages as needed one at a time from
+   the kernel pool, wherever they happen to be, and maps them at
+   consecutive addresses in the VMALLOC_BASE range of base_pml4.
+   Unlike palloc_get_multiple(), it does not need physically
+   contiguous memory, so it still succeeds when free memory is
+   fragmented.  Each allocation is followed by an unmapped guard
+   page, so that running off its end faults instead of silently
+   corrupting the next one.
+
+   Only the kernel can use the memory, and because it is not in
+   the mapping of physical memory at KERN_BASE, vtop() does not
+   work on it. */
+
+/* An allocated range. */
+struct vm_area {
+	struct list_elem elem;      /* Element in area_list. */
+	uint8_t *start;             /* First page. */
+	size_t page_cnt;            /* Number of mapped pages. */
+};
+
+static struct lock vmalloc_lock;    /* Protects all of the below. */
+static struct bitmap *used_map;     /* Pages in use, including guards. */
+static struct list area_list;       /* Allocated ranges. */
+
+static void unmap_pages (uint8_t *start, size_t page_cnt);
+
+/* Initializes the vmalloc() allocator.  Must be called after
+   paging_init(). */
+void
+vmalloc_init (void) {
+	lock_init (&vmalloc_lock);
+	list_init (&area_list);
+	used_map = bitmap_create (VMALLOC_PAGES);
+	if (used_map == NULL)
+		PANIC ("vmalloc_init: out of memory");
+}
+
+/* Obtains and returns a page-aligned, virtually contiguous block
+   of at least SIZE bytes.  Returns a null pointer if memory or
+   address space is not available. */
+void *
+vmalloc (size_t size) {
+	size_t page_cnt = DIV_ROUND_UP (size, PGSIZE);
+	struct vm_area *area;
+	size_t idx, i;
+
+	if (used_map == NULL || page_cnt == 0)
+		return NULL;
+
+	area = malloc (sizeof *area);
+	if (area == NULL)
+		return NULL;
+
+	lock_acquire (&vmalloc_lock);
+	idx = bitmap_scan_and_flip (used_map, 0, page_cnt + 1, false);
+	if (idx == BITMAP_ERROR)
+		goto fail;
+	area->start = (uint8_t *) VMALLOC_BASE + idx * PGSIZE;
+	area->page_cnt = page_cnt;
+
+	for (i = 0; i < page_cnt; i++) {
+		uint8_t *va = area->start + i * PGSIZE;
+		void *kpage = palloc_get_page (0);
+		uint64_t *pte;
+
+		pte = kpage != NULL ? pml4e_walk (base_pml4, (uint64_t) va, 1) : NULL;
+		if (pte == NULL) {
+			palloc_free_page (kpage);
+			unmap_pages (area->start, i);
+			bitmap_set_multiple (used_map, idx, page_cnt + 1, false);
+			goto fail;
+		}
+		ASSERT ((*pte & PTE_P) == 0);
+		*pte = vtop (kpage) | PTE_P | PTE_W | PTE_G;
+	}
+	list_push_front (&area_list, &area->elem);
+	lock_release (&vmalloc_lock);
+	return area->start;
+
+fail:
+	lock_release (&vmalloc_lock);
+	free (area);
+	return NULL;
+}
+
+/* Frees block P, which must have been previously allocated with
+   vmalloc(). */
+void
+vfree (void *p) {
+	struct list_elem *e;
+
+	if (p == NULL)
+		return;
+	ASSERT (is_vmalloc_addr (p));
+
+	lock_acquire (&vmalloc_lock);
+	for (e = list_begin (&area_list); e != list_end (&area_list);
+			e = list_next (e)) {
+		struct vm_area *area = list_entry (e, struct vm_area, elem);
+		if (area->start == p) {
+			size_t idx = pg_no (area->start) - pg_no (VMALLOC_BASE);
+
+			list_remove (&area->elem);
+			unmap_pages (area->start, area->page_cnt);
+			bitmap_set_multiple (used_map, idx, area->page_cnt + 1, false);
+			lock_release (&vmalloc_lock);
+			free (area);
+			return;
+		}
+	}
+	PANIC ("vfree: %p was not allocated by vmalloc()", p);
+}
+
+/* Unmaps the PAGE_CNT pages starting at START and frees the pages
+   they were mapped to.  The mappings are global, so invlpg drops
+   them from the TLB whichever PCID they were used under.  The
+   caller must hold vmalloc_lock. */
+static void
+unmap_pages (uint8_t *start, size_t page_cnt) {
+	size_t i;
+
+	for (i = 0; i < page_cnt; i++) {
+		uint8_t *va = start + i * PGSIZE;
+		uint64_t *pte = pml4e_walk (base_pml4, (uint64_t) va, 0);
+
+		ASSERT (pte != NULL && (*pte & PTE_P) != 0);
+		palloc_free_page (ptov (PTE_ADDR (*pte)));
+		*pte = 0;
+		invlpg ((uint64_t) va);
+	}
+}
@@ -500,6 +500,9 @@ validate_segment(const struct Phdr *phdr, struct file *file)
 /* load() helpers. */
 static bool install_page(void *upage, void *kpage, bool writable);
 
+/* Most pages of a segment read from its file with one request. */
+#define LOAD_BATCH 16
+
 /* Loads a segment starting at offset OFS in FILE at address
  * UPAGE.  In total, READ_BYTES + ZERO_BYTES bytes of virtual
  * memory are initialized, as follows:
@@ -525,37 +528,52 @@ load_segment(struct file *file, off_t ofs, uint8_t *upage,
 	file_seek(file, ofs);
 	while (read_bytes > 0 || zero_bytes > 0)
 	{
-		/* Do calculate how to fill this page.
-		 * We will read PAGE_READ_BYTES bytes from FILE
-		 * and zero the final PAGE_ZERO_BYTES bytes. */
-		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-		size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-		/* Get a page of memory. */
-		uint8_t *kpage = palloc_get_page(PAL_USER);
-		if (kpage == NULL)
-			return false;
-
-		/* Load this page. */
-		if (file_read(file, kpage, page_read_bytes) != (int)page_read_bytes)
+		/* Get up to LOAD_BATCH contiguous pages of memory, so that
+		 * they can be filled with one read of whole sectors, or as
+		 * many as are available. */
+		size_t page_cnt = (read_bytes + zero_bytes) / PGSIZE;
+		uint8_t *kpages = NULL;
+		size_t i;
+
+		if (page_cnt > LOAD_BATCH)
+			page_cnt = LOAD_BATCH;
+		for (; page_cnt > 0; page_cnt /= 2)
 		{
-			palloc_free_page(kpage);
-			return false;
+			kpages = palloc_get_multiple(PAL_USER, page_cnt);
+			if (kpages != NULL)
+				break;
 		}
-		memset(kpage + page_read_bytes, 0, page_zero_bytes);
+		if (kpages == NULL)
+			return false;
+
+		/* Do calculate how to fill these pages.
+		 * We will read BATCH_READ_BYTES bytes from FILE
+		 * and zero the final BATCH_ZERO_BYTES bytes. */
+		size_t batch_bytes = page_cnt * PGSIZE;
+		size_t batch_read_bytes = read_bytes < batch_bytes ? read_bytes : batch_bytes;
+		size_t batch_zero_bytes = batch_bytes - batch_read_bytes;
 
-		/* Add the page to the process's address space. */
-		if (!install_page(upage, kpage, writable))
+		/* Load these pages. */
+		if (file_read(file, kpages, batch_read_bytes) != (int)batch_read_bytes)
 		{
-			printf("fail\n");
-			palloc_free_page(kpage);
+			palloc_free_multiple(kpages, page_cnt);
 			return false;
 		}
+		memset(kpages + batch_read_bytes, 0, batch_zero_bytes);
+
+		/* Add the pages to the process's address space.  Each is
+		 * freed on its own when the process exits. */
+		for (i = 0; i < page_cnt; i++)
+			if (!install_page(upage + i * PGSIZE, kpages + i * PGSIZE, writable))
+			{
+				palloc_free_multiple(kpages + i * PGSIZE, page_cnt - i);
+				return false;
+			}
 
 		/* Advance. */
-		read_bytes -= page_read_bytes;
-		zero_bytes -= page_zero_bytes;
-		upage += PGSIZE;
+		read_bytes -= batch_read_bytes;
+		zero_bytes -= batch_zero_bytes;
+		upage += batch_bytes;
 	}
 	return true;
 }
@@ -602,12 +620,12 @@ install_page(void *upage, void *kpage, bool writable)
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
+/* Loads PAGE, part of region AUX, from the region's file on the
+ * first page fault on it, along with the pages around it. */
 static bool
 lazy_load_segment(struct page *page, void *aux)
 {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
+	return vm_region_load(page, aux);
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -628,10 +646,31 @@ static bool
 load_segment(struct file *file, off_t ofs, uint8_t *upage,
 			 uint32_t read_bytes, uint32_t zero_bytes, bool writable)
 {
+	struct supplemental_page_table *spt = &thread_current()->spt;
+	struct vm_region *r;
+
 	ASSERT((read_bytes + zero_bytes) % PGSIZE == 0);
 	ASSERT(pg_ofs(upage) == 0);
 	ASSERT(ofs % PGSIZE == 0);
 
+	/* The segment's region records where its pages come from, and
+	 * holds its own reference to FILE for loading them. */
+	r = spt_add_region(spt, upage, read_bytes + zero_bytes,
+					   writable ? REGION_DATA : REGION_CODE, writable);
+	if (r == NULL)
+		return false;
+	r->file = file_reopen(file);
+	r->ofs = ofs;
+	r->file_bytes = read_bytes;
+	if (r->file == NULL)
+		return false;
+
+	/* Text frames may be shared with other processes running the
+	 * same program: keep them current. */
+	if (!writable)
+		file_deny_write(r->file);
+	vm_region_set_large(r);
+
 	while (read_bytes > 0 || zero_bytes > 0)
 	{
 		/* Do calculate how to fill this page.
@@ -640,10 +679,12 @@ load_segment(struct file *file, off_t ofs, uint8_t *upage,
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
-		if (!vm_alloc_page_with_initializer(VM_ANON, upage,
-											writable, lazy_load_segment, aux))
+		/* Pages mapped with large pages have no struct page.  Text
+		 * stays file-backed, so that evicting it needs no I/O. */
+		if (!vm_region_large(r, upage)
+			&& !vm_alloc_page_with_initializer(writable ? VM_ANON : VM_FILE,
+											   upage, writable,
+											   lazy_load_segment, r))
 			return false;
 
 		/* Advance. */
@@ -654,17 +695,26 @@ load_segment(struct file *file, off_t ofs, uint8_t *upage,
 	return true;
 }
 
-/* Create a PAGE of stack at the USER_STACK. Return true on success. */
+/* Create a PAGE of stack at the USER_STACK. Return true on success.
+ * The stack's region reserves room for it to grow on faults, up to
+ * vm_stack_pages pages. */
 static bool
 setup_stack(struct intr_frame *if_)
 {
 	bool success = false;
 	void *stack_bottom = (void *)(((uint8_t *)USER_STACK) - PGSIZE);
-
-	/* TODO: Map the stack on stack_bottom and claim the page immediately.
-	 * TODO: If success, set the rsp accordingly.
-	 * TODO: You should mark the page is stack. */
-	/* TODO: Your code goes here */
+	size_t stack_size = (vm_stack_pages > 0 ? vm_stack_pages : 1) * PGSIZE;
+
+	/* Map the stack on stack_bottom and claim the page immediately. */
+	if (spt_add_region(&thread_current()->spt,
+					   (uint8_t *)USER_STACK - stack_size, stack_size,
+					   REGION_STACK, true) != NULL
+		&& vm_alloc_page(VM_ANON, stack_bottom, true)
+		&& vm_claim_page(stack_bottom))
+	{
+		if_->rsp = USER_STACK;
+		success = true;
+	}
 
 	return success;
 }
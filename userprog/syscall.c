@@ -40,6 +40,11 @@ syscall_init (void) {
 /* The main system call interface */
 void
 syscall_handler (struct intr_frame *f UNUSED) {
+#ifdef VM
+	/* Page faults in the kernel on the user stack need the user's rsp
+	 * to tell a push from a stray access. */
+	thread_current ()->user_rsp = f->rsp;
+#endif
 	// TODO: Your implementation goes here.
 	printf ("system call!\n");
 	thread_exit ();
@@ -1,7 +1,13 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
 #include "vm/vm.h"
+#include <bitmap.h>
+#include <stdio.h>
+#include <string.h>
 #include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,36 +23,210 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+/* The swap disk is divided into page-sized slots.  Pages evicted
+ * together are written to consecutive slots in one request, and a
+ * page read back brings along the pages of the same process in the
+ * slots after it, if there are free frames for them.
+ *
+ * A frame shared by several processes since a fork() is written to
+ * a single slot, as is one page of a process that forks while it is
+ * swapped out, and each sharer reads the slot back on its own.  Such
+ * a slot is counted in slot_ref and is freed by the last of them; it
+ * has no entry in slot_page, so it is never read ahead. */
+
+/* Sectors per swap slot. */
+#define SLOT_SECTORS (PGSIZE / DISK_SECTOR_SIZE)
+
+static size_t slot_cnt;                 /* Number of slots. */
+static struct bitmap *slot_map;         /* Slots in use. */
+static struct page **slot_page;         /* Page in each unshared slot. */
+static unsigned *slot_ref;              /* Pages referring to each slot. */
+static struct lock swap_lock;           /* Protects the above. */
+
+/* Staging area for clustered I/O, SWAP_CLUSTER pages.  Only used
+ * during eviction and page-in, which the frame table's lock
+ * serializes. */
+static uint8_t *swap_buf;
+
+/* Statistics. */
+static long long swap_write_cnt, swap_out_cnt;
+static long long swap_read_cnt, swap_in_cnt, swap_ahead_cnt;
+
+static size_t slot_alloc (size_t cnt);
+static void slot_free (size_t slot);
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	/* Set up the swap_disk. */
+	swap_disk = disk_get (1, 1);
+	lock_init (&swap_lock);
+	if (swap_disk == NULL)
+		return;
+
+	slot_cnt = disk_size (swap_disk) / SLOT_SECTORS;
+	slot_map = bitmap_create (slot_cnt);
+	slot_page = calloc (slot_cnt, sizeof *slot_page);
+	slot_ref = calloc (slot_cnt, sizeof *slot_ref);
+	swap_buf = palloc_get_multiple (0, SWAP_CLUSTER);
+	if (slot_map == NULL || slot_page == NULL || slot_ref == NULL
+			|| swap_buf == NULL)
+		PANIC ("vm_anon_init: out of memory");
 }
 
 /* Initialize the file mapping */
 bool
-anon_initializer (struct page *page, enum vm_type type, void *kva) {
+anon_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->slot = BITMAP_ERROR;
+	return true;
 }
 
-/* Swap in the page by read contents from the swap disk. */
+/* Swap in the page by read contents from the swap disk.  The pages
+ * of the same process in the slots that follow, if any, are read in
+ * the same request and put in memory too while there are free
+ * frames. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	size_t slot = anon_page->slot;
+	struct page *ahead[SWAP_CLUSTER];
+	size_t cnt, i;
+
+	/* A page never swapped out is still all zeros. */
+	if (slot == BITMAP_ERROR)
+		return true;
+
+	lock_acquire (&swap_lock);
+	ahead[0] = page;
+	for (cnt = 1; cnt < SWAP_CLUSTER && slot + cnt < slot_cnt; cnt++) {
+		struct page *p = slot_page[slot + cnt];
+		if (p == NULL || p->owner != page->owner || p->frame != NULL)
+			break;
+		ahead[cnt] = p;
+	}
+	lock_release (&swap_lock);
+
+	disk_read_multiple (swap_disk, slot * SLOT_SECTORS, cnt * SLOT_SECTORS,
+			swap_buf);
+	swap_read_cnt++;
+
+	memcpy (kva, swap_buf, PGSIZE);
+	slot_free (slot);
+	anon_page->slot = BITMAP_ERROR;
+	swap_in_cnt++;
+
+	for (i = 1; i < cnt; i++) {
+		if (!vm_install_page (ahead[i], swap_buf + i * PGSIZE))
+			break;
+		slot_free (ahead[i]->anon.slot);
+		ahead[i]->anon.slot = BITMAP_ERROR;
+		swap_ahead_cnt++;
+	}
+	return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	return anon_swap_out_cluster (&page, 1);
+}
+
+/* Writes the CNT anonymous pages in PAGES, at most SWAP_CLUSTER,
+ * which must be in memory but unmapped, to consecutive swap slots
+ * in one request.  Every page sharing one of their frames gets the
+ * frame's slot.  The caller frees the frames.  Returns false if swap
+ * space is exhausted. */
+bool
+anon_swap_out_cluster (struct page *pages[], size_t cnt) {
+	size_t slot, i;
+
+	ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+
+	slot = slot_alloc (cnt);
+	if (slot == BITMAP_ERROR)
+		return false;
+
+	for (i = 0; i < cnt; i++) {
+		struct frame *frame = pages[i]->frame;
+		struct list_elem *e;
+
+		memcpy (swap_buf + i * PGSIZE, frame->kva, PGSIZE);
+		for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+				e = list_next (e)) {
+			struct page *p = list_entry (e, struct page, frame_elem);
+			ASSERT (p->anon.slot == BITMAP_ERROR);
+			p->anon.slot = slot + i;
+		}
+		lock_acquire (&swap_lock);
+		slot_ref[slot + i] = frame->ref_cnt;
+		slot_page[slot + i] = frame->ref_cnt == 1 ? pages[i] : NULL;
+		lock_release (&swap_lock);
+	}
+	disk_write_multiple (swap_disk, slot * SLOT_SECTORS, cnt * SLOT_SECTORS,
+			swap_buf);
+	swap_write_cnt++;
+	swap_out_cnt += cnt;
+	return true;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	if (anon_page->slot != BITMAP_ERROR)
+		slot_free (anon_page->slot);
+	vm_release_frame (page);
+}
+
+/* Allocates CNT consecutive swap slots and returns the first, or
+ * BITMAP_ERROR if there are not that many. */
+static size_t
+slot_alloc (size_t cnt) {
+	size_t slot = BITMAP_ERROR;
+
+	if (slot_map != NULL) {
+		lock_acquire (&swap_lock);
+		slot = bitmap_scan_and_flip (slot_map, 0, cnt, false);
+		lock_release (&swap_lock);
+	}
+	return slot;
+}
+
+/* Drops a reference to swap slot SLOT, freeing it if it was the
+ * last. */
+static void
+slot_free (size_t slot) {
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_test (slot_map, slot));
+	ASSERT (slot_ref[slot] > 0);
+	if (--slot_ref[slot] == 0)
+		bitmap_reset (slot_map, slot);
+	slot_page[slot] = NULL;
+	lock_release (&swap_lock);
+}
+
+/* Adds a reference to swap slot SLOT, for a page copied by fork()
+ * while swapped out. */
+void
+anon_share_slot (size_t slot) {
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_test (slot_map, slot));
+	slot_ref[slot]++;
+	slot_page[slot] = NULL;
+	lock_release (&swap_lock);
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void) {
+	printf ("Swap: %lld pages out in %lld writes, "
+			"%lld pages in in %lld reads, %lld read ahead\n",
+			swap_out_cnt, swap_write_cnt, swap_in_cnt, swap_read_cnt,
+			swap_ahead_cnt);
 }
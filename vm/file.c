@@ -1,6 +1,8 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
 #include "vm/vm.h"
+#include "filesys/inode.h"
+#include "threads/vaddr.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
@@ -21,38 +23,96 @@ vm_file_init (void) {
 
 /* Initialize the file backed page */
 bool
-file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
+file_backed_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &file_ops;
-
-	struct file_page *file_page = &page->file;
+	return true;
 }
 
-/* Swap in the page by read contents from the file. */
+/* Swap in the page by read contents from the file.  Everything the
+ * page needs to know is in its region. */
 static bool
-file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+file_backed_swap_in (struct page *page, void *kva UNUSED) {
+	return vm_region_load (page, page->region);
 }
 
-/* Swap out the page by writeback contents to the file. */
+/* Swap out the page by passing its contents to the page cache, to
+ * be written back to the file, if it has been modified. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	vm_region_writeback (&page->owner->spt, page->region, page->va,
+			(uint8_t *) page->va + PGSIZE);
+	return true;
 }
 
-/* Destory the file backed page. PAGE will be freed by the caller. */
+/* Destory the file backed page. PAGE will be freed by the caller.
+ * do_munmap() and process exit write back the whole region first,
+ * so that this usually finds nothing to do. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	if (page->frame != NULL)
+		file_backed_swap_out (page);
+	vm_release_frame (page);
 }
 
-/* Do the mmap */
+/* Do the mmap: maps LENGTH bytes of FILE, starting at OFFSET, at
+ * ADDR, lazily, and returns ADDR, or a null pointer if the mapping
+ * is not possible.  The last page reads as zeros past the end of
+ * the file.  The mapping has its own reference to FILE. */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vm_region *r;
+	off_t file_len;
+	uint8_t *va;
+
+	if (addr == NULL || pg_ofs (addr) != 0 || length == 0 || file == NULL
+			|| offset < 0 || offset % PGSIZE != 0
+			|| !is_user_vaddr ((uint8_t *) addr + length - 1))
+		return NULL;
+	file_len = file_length (file);
+	if (file_len <= offset)
+		return NULL;
+
+	r = spt_add_region (spt, addr, length, REGION_MMAP, writable);
+	if (r == NULL)
+		return NULL;
+	r->file = file_reopen (file);
+	r->ofs = offset;
+	r->file_bytes = (size_t) (file_len - offset);
+	if (r->file_bytes > (size_t) (r->end - r->start))
+		r->file_bytes = r->end - r->start;
+	if (r->file == NULL)
+		goto fail;
+
+	/* A new file gets its sectors only when its pages are written
+	 * back, so make sure there is room for what the mapping may
+	 * write. */
+	if (writable && !inode_reserve (file_get_inode (r->file)))
+		goto fail;
+
+	for (va = r->start; va < r->end; va += PGSIZE)
+		if (!vm_alloc_page_with_initializer (VM_FILE, va, writable,
+					vm_region_load, r))
+			goto fail;
+	return addr;
+
+fail:
+	spt_remove_region (spt, r);
+	return NULL;
 }
 
-/* Do the munmap */
+/* Do the munmap: passes the modified pages of the mapping at ADDR to
+ * the page cache and removes it. */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vm_region *r = spt_find_region (spt, addr);
+
+	if (r == NULL || r->kind != REGION_MMAP || r->start != addr)
+		return;
+	vm_region_writeback (spt, r, r->start, r->end);
+	spt_remove_region (spt, r);
 }
@@ -1,9 +1,88 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <bitmap.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/page_cache.h"
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
 
+/* Caches of struct page and struct frame.  Pages may also be
+ * released with free(), as vm_dealloc_page() does. */
+static struct kmem_cache *page_cache;
+static struct kmem_cache *frame_cache;
+
+/* Frame table: every frame holding a user page, in clock order.  The
+ * clock hand points at the next frame to consider for eviction. */
+static struct list frame_table;
+static struct list_elem *clock_hand;
+
+/* Protects the frame table, and is held while a frame changes hands,
+ * including any I/O, so that a page is never read in while it is
+ * still being written out. */
+static struct lock frame_lock;
+
+/* Frames holding pages of files, by file and offset, so that every
+ * process running the same program or mapping the same file maps
+ * the same frames.  Protected by frame_lock. */
+static struct hash file_frames;
+static hash_hash_func file_frame_hash;
+static hash_less_func file_frame_less;
+
+/* Eviction statistics. */
+static long long evict_cnt;             /* Frames evicted. */
+static long long evict_clean_cnt;       /* ...dropping a clean file page. */
+static long long evict_dirty_cnt;       /* ...writing back a file page. */
+static long long evict_anon_cnt;        /* ...swapping out an anon page. */
+
+/* Pages of a file-backed region that one fault brings in, at most. */
+#define FAULT_AROUND_MAX 16
+
+/* -fa: Pages to bring in around a fault on a file-backed region. */
+size_t vm_fault_around = 8;
+
+/* Staging area for loading regions, FAULT_AROUND_MAX pages.
+ * Protected by frame_lock. */
+static uint8_t *region_buf;
+
+/* -sl: Pages a user stack may grow to. */
+size_t vm_stack_pages = 256;
+
+/* Pages a stack growing down one page at a time grows by at once. */
+#define STACK_PREFAULT 4
+
+/* -lp: Map large zero-filled parts of writable segments with large
+ * pages? */
+bool vm_large_pages;
+
+/* Region I/O statistics. */
+static long long load_read_cnt;         /* File reads. */
+static long long load_page_cnt;         /* Pages loaded on a fault. */
+static long long load_around_cnt;       /* ...and around a fault. */
+static long long wb_page_cnt;           /* Dirty pages passed to the
+                                           page cache. */
+static long long map_cnt;               /* Page cache pages mapped. */
+
+/* File pages mapped from another process's frame. */
+static long long file_share_cnt;
+
+/* Stack pages added on a fault, and with it. */
+static long long stack_grow_cnt, stack_prefault_cnt;
+
+/* Large pages mapped, and faults that had to map a small page. */
+static long long large_map_cnt, large_fallback_cnt;
+
+/* Copy-on-write statistics. */
+static long long cow_copy_cnt;          /* Shared frames copied on write. */
+static long long cow_reuse_cnt;         /* ...made writable, no longer shared. */
+
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
 void
@@ -16,6 +95,34 @@ vm_init (void) {
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
 	/* TODO: Your code goes here. */
+	page_cache = kmem_cache_create ("page", sizeof (struct page), NULL);
+	frame_cache = kmem_cache_create ("frame", sizeof (struct frame), NULL);
+	region_buf = palloc_get_multiple (0, FAULT_AROUND_MAX);
+	if (page_cache == NULL || frame_cache == NULL || region_buf == NULL)
+		PANIC ("vm_init: out of memory");
+	list_init (&frame_table);
+	clock_hand = list_end (&frame_table);
+	lock_init (&frame_lock);
+	hash_init (&file_frames, file_frame_hash, file_frame_less, NULL);
+}
+
+/* Prints virtual memory statistics. */
+void
+vm_print_stats (void) {
+	printf ("VM: %lld frames evicted: %lld clean, %lld written back, "
+			"%lld swapped out\n", evict_cnt, evict_clean_cnt, evict_dirty_cnt,
+			evict_anon_cnt);
+	printf ("VM: %lld pages loaded in %lld reads, %lld around faults\n",
+			load_page_cnt + load_around_cnt, load_read_cnt, load_around_cnt);
+	printf ("VM: %lld file pages shared, %lld pages copied on write, "
+			"%lld reused\n", file_share_cnt, cow_copy_cnt, cow_reuse_cnt);
+	printf ("VM: %lld page cache pages mapped, %lld written to\n",
+			map_cnt, wb_page_cnt);
+	printf ("VM: %lld stack pages added, %lld prefaulted\n",
+			stack_grow_cnt + stack_prefault_cnt, stack_prefault_cnt);
+	printf ("VM: %lld large pages mapped, %lld faults fell back to small "
+			"pages\n", large_map_cnt, large_fallback_cnt);
+	swap_print_stats ();
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -36,6 +143,10 @@ page_get_type (struct page *page) {
 static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
 static struct frame *vm_evict_frame (void);
+static bool file_frame_key (struct page *page, struct frame *key);
+static bool file_frame_claim (struct page *page);
+static void file_frame_insert (struct frame *frame, const struct frame *key);
+static void region_free_large (struct vm_region *r);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -50,11 +161,32 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+		bool (*initializer) (struct page *, enum vm_type, void *);
+		struct page *page;
+
+		switch (VM_TYPE (type)) {
+			case VM_ANON:
+				initializer = anon_initializer;
+				break;
+			case VM_FILE:
+				initializer = file_backed_initializer;
+				break;
+			default:
+				goto err;
+		}
 
-		/* TODO: Insert the page into the spt. */
+		page = kmem_cache_alloc (page_cache);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, upage, init, type, aux, initializer);
+		page->owner = thread_current ();
+		page->writable = writable;
+
+		if (!spt_insert_page (spt, page)) {
+			kmem_cache_free (page_cache, page);
+			goto err;
+		}
+		return true;
 	}
 err:
 	return false;
@@ -62,81 +194,1004 @@ err:
 
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	struct page key;
+	struct hash_elem *e;
 
-	return page;
+	key.va = pg_round_down (va);
+	e = hash_find (&spt->pages, &key.spt_elem);
+	return e != NULL ? hash_entry (e, struct page, spt_elem) : NULL;
 }
 
-/* Insert PAGE into spt with validation. */
+/* Insert PAGE into spt with validation.  PAGE joins the region
+ * containing its address, if any. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
+spt_insert_page (struct supplemental_page_table *spt,
+		struct page *page) {
+	ASSERT (pg_ofs (page->va) == 0);
 
-	return succ;
+	if (hash_insert (&spt->pages, &page->spt_elem) != NULL)
+		return false;
+	page->region = spt_find_region (spt, page->va);
+	if (page->region != NULL)
+		list_push_back (&page->region->pages, &page->region_elem);
+	return true;
 }
 
+/* Removes PAGE from SPT and frees it. */
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	hash_delete (&spt->pages, &page->spt_elem);
+	if (page->region != NULL)
+		list_remove (&page->region_elem);
 	vm_dealloc_page (page);
+}
+
+/* Adds a region of LENGTH bytes at START, which must be page
+ * aligned, to SPT and returns it, or returns a null pointer if it
+ * would overlap an existing region or memory is not available.  The
+ * region starts out with no pages and no backing file. */
+struct vm_region *
+spt_add_region (struct supplemental_page_table *spt, void *start,
+		size_t length, enum vm_region_kind kind, bool writable) {
+	struct vm_region *r;
+	struct list_elem *e;
+
+	ASSERT (pg_ofs (start) == 0);
+
+	if (length == 0 || !spt_range_free (spt, start, length))
+		return NULL;
+	r = malloc (sizeof *r);
+	if (r == NULL)
+		return NULL;
+	r->start = start;
+	r->end = (uint8_t *) start + ROUND_UP (length, PGSIZE);
+	r->kind = kind;
+	r->writable = writable;
+	r->file = NULL;
+	r->ofs = 0;
+	r->file_bytes = 0;
+	list_init (&r->pages);
+	r->large_start = r->large_end = NULL;
+	r->large = NULL;
+
+	for (e = list_begin (&spt->regions); e != list_end (&spt->regions);
+			e = list_next (e))
+		if (list_entry (e, struct vm_region, elem)->start > r->start)
+			break;
+	list_insert (e, &r->elem);
+	return r;
+}
+
+/* Returns the region in SPT that contains VA, or a null pointer if
+ * there is none. */
+struct vm_region *
+spt_find_region (struct supplemental_page_table *spt, const void *va) {
+	struct list_elem *e;
+
+	for (e = list_begin (&spt->regions); e != list_end (&spt->regions);
+			e = list_next (e)) {
+		struct vm_region *r = list_entry (e, struct vm_region, elem);
+		if ((const uint8_t *) va < r->start)
+			break;
+		if ((const uint8_t *) va < r->end)
+			return r;
+	}
+	return NULL;
+}
+
+/* Returns true if no region in SPT overlaps the LENGTH bytes at
+ * START. */
+bool
+spt_range_free (struct supplemental_page_table *spt, const void *start,
+		size_t length) {
+	const uint8_t *lo = start, *hi = lo + length;
+	struct list_elem *e;
+
+	if (hi < lo)
+		return false;
+	for (e = list_begin (&spt->regions); e != list_end (&spt->regions);
+			e = list_next (e)) {
+		struct vm_region *r = list_entry (e, struct vm_region, elem);
+		if (hi <= r->start)
+			break;
+		if (lo < r->end)
+			return false;
+	}
 	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Removes REGION and all of its pages from SPT, and closes its
+ * file. */
+void
+spt_remove_region (struct supplemental_page_table *spt,
+		struct vm_region *region) {
+	while (!list_empty (&region->pages)) {
+		struct page *page = list_entry (list_front (&region->pages),
+				struct page, region_elem);
+		spt_remove_page (spt, page);
+	}
+	region_free_large (region);
+	list_remove (&region->elem);
+	file_close (region->file);
+	free (region);
+}
+
+/* Large pages.
+ *
+ * With -lp, the part of a writable region past its file data that
+ * covers whole aligned large pages, such as a big BSS, gets no
+ * struct page at all.  The first fault in each large page maps all
+ * of it, zeroed, with one page directory entry, which takes one TLB
+ * entry instead of LARGE_PGCNT.  Large pages are never evicted: they
+ * stay in memory until the region goes away.  If no aligned block of
+ * memory is free, the fault maps an ordinary page instead, and so do
+ * later faults in the same large page. */
+
+/* Sets up REGION, if -lp is given, to map as much of its zeros as it
+ * can with large pages. */
+void
+vm_region_set_large (struct vm_region *r) {
+	uint8_t *lo, *hi;
+
+	ASSERT (list_empty (&r->pages));
+
+	if (!vm_large_pages || !r->writable)
+		return;
+	lo = (uint8_t *) ROUND_UP ((uint64_t) r->start
+			+ ROUND_UP (r->file_bytes, PGSIZE), LARGE_PGSIZE);
+	hi = (uint8_t *) ROUND_DOWN ((uint64_t) r->end, LARGE_PGSIZE);
+	if (lo >= hi)
+		return;
+	r->large = calloc ((hi - lo) / LARGE_PGSIZE, sizeof *r->large);
+	if (r->large != NULL) {
+		r->large_start = lo;
+		r->large_end = hi;
+	}
+}
+
+/* Returns true if VA, in region R, is in its part mapped with large
+ * pages. */
+bool
+vm_region_large (const struct vm_region *r, const void *va) {
+	return (const uint8_t *) va >= r->large_start
+		&& (const uint8_t *) va < r->large_end;
+}
+
+/* Unmaps and frees the large pages of region R, which belongs to the
+ * current process. */
+static void
+region_free_large (struct vm_region *r) {
+	size_t i;
+
+	if (r->large == NULL)
+		return;
+	for (i = 0; i < (size_t) (r->large_end - r->large_start) / LARGE_PGSIZE;
+			i++)
+		if (r->large[i] != NULL) {
+			pml4_clear_page (thread_current ()->pml4,
+					r->large_start + i * LARGE_PGSIZE);
+			palloc_free_multiple (r->large[i], LARGE_PGCNT);
+		}
+	free (r->large);
+	r->large = NULL;
+}
+
+/* Maps the large page of region R that contains ADDR, or, failing
+ * that, the small page, for the current process. */
+static bool
+vm_large_fault (struct vm_region *r, void *addr) {
+	uint64_t *pml4 = thread_current ()->pml4;
+	uint8_t *upage = (uint8_t *) ROUND_DOWN ((uint64_t) addr, LARGE_PGSIZE);
+	size_t idx = (upage - r->large_start) / LARGE_PGSIZE;
+	uint64_t *pde = pml4e_walk_pde (pml4, (uint64_t) upage, 0);
+
+	/* A page table here holds small pages mapped before. */
+	if (pde == NULL || (*pde & PTE_P) == 0) {
+		void *kpage = palloc_get_aligned (PAL_USER | PAL_ZERO, LARGE_PGCNT,
+				LARGE_PGCNT);
+
+		ASSERT (r->large[idx] == NULL);
+		if (kpage != NULL && pml4_set_large_page (pml4, upage, kpage,
+					r->writable)) {
+			r->large[idx] = kpage;
+			large_map_cnt++;
+			return true;
+		}
+		palloc_free_multiple (kpage, LARGE_PGCNT);
+	}
+
+	large_fallback_cnt++;
+	addr = pg_round_down (addr);
+	return vm_alloc_page (VM_ANON, addr, r->writable) && vm_claim_page (addr);
+}
+
+/* Gives region COPY, just copied from R for fork(), copies of R's
+ * large pages, in the current process. */
+static bool
+region_copy_large (struct vm_region *copy, const struct vm_region *r) {
+	size_t cnt = (r->large_end - r->large_start) / LARGE_PGSIZE;
+	size_t i;
+
+	copy->large = calloc (cnt, sizeof *copy->large);
+	if (copy->large == NULL)
+		return false;
+	copy->large_start = r->large_start;
+	copy->large_end = r->large_end;
+	for (i = 0; i < cnt; i++) {
+		void *kpage;
+
+		if (r->large[i] == NULL)
+			continue;
+		kpage = palloc_get_aligned (PAL_USER, LARGE_PGCNT, LARGE_PGCNT);
+		if (kpage == NULL)
+			return false;
+		memcpy (kpage, r->large[i], LARGE_PGSIZE);
+		if (!pml4_set_large_page (thread_current ()->pml4,
+					copy->large_start + i * LARGE_PGSIZE, kpage, copy->writable)) {
+			palloc_free_multiple (kpage, LARGE_PGCNT);
+			return false;
+		}
+		copy->large[i] = kpage;
+		large_map_cnt++;
+	}
+	return true;
+}
+
+/* Makes PAGE one of the pages sharing FRAME. */
+static void
+frame_attach (struct frame *frame, struct page *page) {
+	list_push_back (&frame->pages, &page->frame_elem);
+	frame->ref_cnt++;
+	frame->page = list_entry (list_front (&frame->pages), struct page,
+			frame_elem);
+	page->frame = frame;
+}
+
+/* Takes PAGE off the pages sharing its frame, and returns how many
+ * are left. */
+static size_t
+frame_detach (struct page *page) {
+	struct frame *frame = page->frame;
+
+	list_remove (&page->frame_elem);
+	page->frame = NULL;
+	frame->page = --frame->ref_cnt > 0
+		? list_entry (list_front (&frame->pages), struct page, frame_elem)
+		: NULL;
+	return frame->ref_cnt;
+}
+
+/* Frees FRAME, which no page shares any more, and its memory,
+ * giving it back to the page cache if it came from there. */
+static void
+frame_free (struct frame *frame) {
+	if (frame->cache != NULL)
+		page_cache_unmap (frame->cache);
+	else
+		palloc_free_page (frame->kva);
+	kmem_cache_free (frame_cache, frame);
+}
+
+/* Unmaps FRAME from every page sharing it. */
+static void
+frame_unmap (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		pml4_clear_page (page->owner->pml4, page->va);
+	}
+}
+
+/* Returns true if any page sharing FRAME was accessed since the last
+ * call, and clears their accessed bits. */
+static bool
+frame_test_accessed (struct frame *frame) {
+	struct list_elem *e;
+	bool accessed = false;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		if (pml4_is_accessed (page->owner->pml4, page->va)) {
+			pml4_set_accessed (page->owner->pml4, page->va, false);
+			accessed = true;
+		}
+	}
+	return accessed;
+}
+
+/* Returns true if FRAME has been modified through any page sharing
+ * it since it was last marked clean. */
+static bool
+frame_is_dirty (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		if (pml4_is_dirty (page->owner->pml4, page->va))
+			return true;
+	}
+	return false;
+}
+
+/* Marks FRAME clean in every page sharing it. */
+static void
+frame_clear_dirty (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		pml4_set_dirty (page->owner->pml4, page->va, false);
+	}
+}
+
+/* Returns true if evicting FRAME needs no I/O: its page comes from
+ * a file and has not been modified through any mapping. */
+static bool
+frame_is_clean (struct frame *frame) {
+	return page_get_type (frame->page) == VM_FILE && !frame_is_dirty (frame);
+}
+
+/* Advances the clock hand, wrapping around, and returns the frame it
+ * passes over. */
+static struct frame *
+clock_next (void) {
+	if (clock_hand == list_end (&frame_table))
+		clock_hand = list_begin (&frame_table);
+	struct frame *frame = list_entry (clock_hand, struct frame, elem);
+	clock_hand = list_next (clock_hand);
+	return frame;
+}
+
+/* Get the struct frame, that will be evicted.
+ *
+ * Second chance: the hand clears the accessed bit of each frame it
+ * passes, and a frame whose bit was already clear has not been used
+ * for a full turn of the clock.  Of those, a clean file page is
+ * taken at once; otherwise the first one found is taken, unless a
+ * clean one turns up within another turn.  The caller must hold
+ * frame_lock. */
 static struct frame *
 vm_get_victim (void) {
 	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+	size_t frame_cnt = list_size (&frame_table);
+	size_t i;
 
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	for (i = 0; i < 3 * frame_cnt; i++) {
+		struct frame *frame = clock_next ();
+
+		if (frame_test_accessed (frame))
+			continue;
+		if (frame_is_clean (frame))
+			return frame;
+		if (victim == NULL)
+			victim = frame;
+		else if (frame == victim)
+			break;
+	}
 	return victim;
 }
 
+/* Removes FRAME from the frame table, and from file_frames if it is
+ * there, before it is freed or reused. */
+static void
+frame_table_remove (struct frame *frame) {
+	if (clock_hand == &frame->elem)
+		clock_hand = list_next (clock_hand);
+	list_remove (&frame->elem);
+	if (frame->file_inode != NULL) {
+		hash_delete (&file_frames, &frame->file_elem);
+		frame->file_inode = NULL;
+	}
+}
+
+/* Swaps out anonymous page VICTIM, and with it, in one request, the
+ * pages of the same process that follow it in the frame table at
+ * consecutive addresses, do not share their frames, and have not
+ * been used since the clock last passed them, if any.  Frees the
+ * frames of the latter.  The caller must hold frame_lock and has
+ * unmapped VICTIM. */
+static void
+evict_anon_cluster (struct frame *victim) {
+	struct page *pages[SWAP_CLUSTER];
+	struct list_elem *e;
+	size_t cnt = 1, i;
+
+	pages[0] = victim->page;
+	for (e = list_next (&victim->elem);
+			e != list_end (&frame_table) && cnt < SWAP_CLUSTER;
+			e = list_next (e)) {
+		struct frame *frame = list_entry (e, struct frame, elem);
+		struct page *page = frame->page;
+		if (frame->ref_cnt != 1
+				|| page->owner != pages[0]->owner
+				|| page->va != pages[cnt - 1]->va + PGSIZE
+				|| page_get_type (page) != VM_ANON
+				|| pml4_is_accessed (page->owner->pml4, page->va))
+			break;
+		pml4_clear_page (page->owner->pml4, page->va);
+		pages[cnt++] = page;
+	}
+
+	if (!anon_swap_out_cluster (pages, cnt))
+		PANIC ("vm_evict_frame: out of swap space");
+	evict_cnt += cnt;
+	evict_anon_cnt += cnt;
+
+	for (i = 1; i < cnt; i++) {
+		struct frame *frame = pages[i]->frame;
+		frame_detach (pages[i]);
+		frame_table_remove (frame);
+		frame_free (frame);
+	}
+}
+
 /* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+ * Return NULL on error.  The caller must hold frame_lock. */
 static struct frame *
 vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+	struct frame *victim = vm_get_victim ();
+	struct page *page;
 
-	return NULL;
+	if (victim == NULL)
+		return NULL;
+
+	/* Unmap the page first, so that its owners fault, and wait for
+	 * frame_lock, instead of modifying it while it is written out.
+	 * Clearing the present bit leaves the dirty bit for swap_out(). */
+	page = victim->page;
+	if (page_get_type (page) == VM_ANON) {
+		frame_unmap (victim);
+		evict_anon_cluster (victim);
+	} else {
+		evict_cnt++;
+		if (frame_is_clean (victim))
+			evict_clean_cnt++;
+		else
+			evict_dirty_cnt++;
+		frame_unmap (victim);
+		if (!swap_out (page))
+			PANIC ("vm_evict_frame: cannot evict page at %p", page->va);
+	}
+
+	frame_table_remove (victim);
+	while (!list_empty (&victim->pages))
+		frame_detach (list_entry (list_front (&victim->pages), struct page,
+					frame_elem));
+
+	/* A page cache page becomes an ordinary frame, unless the cache is
+	 * using it for something else: then try again. */
+	if (victim->cache != NULL) {
+		bool reclaimed = page_cache_reclaim (victim->cache);
+
+		victim->cache = NULL;
+		if (!reclaimed) {
+			kmem_cache_free (frame_cache, victim);
+			return vm_evict_frame ();
+		}
+	}
+	return victim;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
  * and return it. This always return valid address. That is, if the user pool
  * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * space.  The caller must hold frame_lock. */
 static struct frame *
 vm_get_frame (void) {
-	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+	/* Zeroed, so that new anonymous pages read as zeros and no frame
+	 * shows its previous contents; the idle thread usually has one
+	 * ready. */
+	void *kva = palloc_get_page (PAL_USER | PAL_ZERO);
+	struct frame *frame;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (kva != NULL) {
+		frame = kmem_cache_alloc (frame_cache);
+		if (frame == NULL)
+			PANIC ("vm_get_frame: out of memory");
+		frame->kva = kva;
+	} else {
+		frame = vm_evict_frame ();
+		if (frame == NULL)
+			PANIC ("vm_get_frame: out of frames");
+		memset (frame->kva, 0, PGSIZE);
+	}
+	frame->page = NULL;
+	list_init (&frame->pages);
+	frame->ref_cnt = 0;
+	frame->file_inode = NULL;
+	frame->cache = NULL;
+
+	/* Newly loaded pages go just behind the hand, the last place it
+	 * will look. */
+	list_insert (clock_hand, &frame->elem);
 
 	ASSERT (frame != NULL);
 	ASSERT (frame->page == NULL);
 	return frame;
 }
 
-/* Growing the stack. */
+/* Returns a new frame for the page at OFS in mapped file INODE, the
+ * memory of which is the page cache's page for it, read in if
+ * needed, evicting frames if the cache has no room.  The caller
+ * must hold frame_lock. */
+static struct frame *
+vm_get_cache_frame (struct inode *inode, off_t ofs) {
+	struct page_cache *pc;
+	struct frame *frame;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	while ((pc = page_cache_map (inode, ofs)) == NULL) {
+		frame = vm_evict_frame ();
+		if (frame == NULL)
+			PANIC ("vm_get_cache_frame: out of frames");
+		palloc_free_page (frame->kva);
+		kmem_cache_free (frame_cache, frame);
+	}
+	frame = kmem_cache_alloc (frame_cache);
+	if (frame == NULL)
+		PANIC ("vm_get_cache_frame: out of memory");
+	frame->kva = pc->kva;
+	frame->page = NULL;
+	list_init (&frame->pages);
+	frame->ref_cnt = 0;
+	frame->file_inode = NULL;
+	frame->cache = pc;
+	list_insert (clock_hand, &frame->elem);
+	map_cnt++;
+	return frame;
+}
+
+/* Puts PAGE, which is not in memory, into a free frame with the
+ * contents DATA, or zeros if DATA is null, and maps it, for reading
+ * ahead.  Returns false, doing nothing, if no frame is free; never
+ * evicts.  The caller must hold frame_lock, as it does while a page
+ * is brought in. */
+bool
+vm_install_page (struct page *page, const void *data) {
+	struct frame *frame;
+	void *kva;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (page->frame == NULL);
+
+	kva = palloc_get_page (data != NULL ? PAL_USER : PAL_USER | PAL_ZERO);
+	if (kva == NULL)
+		return false;
+	frame = kmem_cache_alloc (frame_cache);
+	if (frame == NULL
+			|| !pml4_set_page (page->owner->pml4, page->va, kva,
+				page->writable)) {
+		kmem_cache_free (frame_cache, frame);
+		palloc_free_page (kva);
+		return false;
+	}
+	if (data != NULL)
+		memcpy (kva, data, PGSIZE);
+	frame->kva = kva;
+	list_init (&frame->pages);
+	frame->ref_cnt = 0;
+	frame->file_inode = NULL;
+	frame->cache = NULL;
+	frame_attach (frame, page);
+	list_insert (clock_hand, &frame->elem);
+	return true;
+}
+
+/* Unmaps PAGE, if it is in memory, and frees its frame unless other
+ * pages still share it.  Called by the destroy operations, after any
+ * writeback. */
+void
+vm_release_frame (struct page *page) {
+	struct frame *frame = page->frame;
+	bool held;
+
+	if (frame == NULL)
+		return;
+
+	held = lock_held_by_current_thread (&frame_lock);
+	if (!held)
+		lock_acquire (&frame_lock);
+	pml4_clear_page (page->owner->pml4, page->va);
+	if (frame_detach (page) == 0) {
+		frame_table_remove (frame);
+		frame_free (frame);
+	}
+	if (!held)
+		lock_release (&frame_lock);
+}
+
+/* Returns true if PAGE is yet to be loaded from region R by
+ * vm_region_load(), for the first time or, if it is program text,
+ * again after being evicted. */
+static bool
+region_page_pending (struct page *page, struct vm_region *r) {
+	if (page == NULL || page->frame != NULL)
+		return false;
+	if (VM_TYPE (page->operations->type) == VM_UNINIT)
+		return page->uninit.aux == r;
+	return page->region == r && r->kind == REGION_CODE && !r->writable;
+}
+
+/* Shared file frames.
+ *
+ * A page of a file is the same in every process that maps it, so
+ * the frame it is loaded into is entered in file_frames under the
+ * file's inode and the offset and length of the page's part of it,
+ * and a process loading the same page later maps that frame instead
+ * of reading its own copy.  This covers read-only executable
+ * segments and mapped files, writes to which every process sharing
+ * a frame then sees at once, as they would through the file.  The
+ * two are told apart.  Both are file-backed: a text frame is never
+ * dirty, so evicting it just drops it, and it is read back from the
+ * file.
+ * The frame of a page of a mapped file is the page cache's page for
+ * it, so the data is in memory only once whichever way it is read.
+ * A frame is shared like one shared by fork(): it leaves the table
+ * when it is evicted, or freed by the last process using it.
+ * load_segment() denies writes to an executable for as long as it
+ * is mapped, so that text frames stay current. */
+
+/* Sets the file frame key in KEY for PAGE, and returns true, if
+ * PAGE is a page of program text or of a mapped file that is not in
+ * memory and may share a frame. */
+static bool
+file_frame_key (struct page *page, struct frame *key) {
+	struct vm_region *r = page->region;
+	size_t ofs;
+
+	if (r == NULL || r->file == NULL || page->frame != NULL)
+		return false;
+	if (r->kind == REGION_CODE && !r->writable)
+		key->file_text = true;
+	else if (r->kind == REGION_MMAP)
+		key->file_text = false;
+	else
+		return false;
+
+	ofs = (uint8_t *) page->va - r->start;
+	key->file_inode = file_get_inode (r->file);
+	key->file_ofs = r->ofs + ofs;
+	key->file_bytes = 0;
+	if (ofs < r->file_bytes)
+		key->file_bytes = r->file_bytes - ofs < PGSIZE
+			? r->file_bytes - ofs : PGSIZE;
+	return true;
+}
+
+/* Makes PAGE, if it has never been loaded, the type it would be after
+ * its first fault, without running its initializer, since its
+ * contents are already in KVA.  Returns true if successful. */
+static bool
+page_init_loaded (struct page *page, void *kva) {
+	return VM_TYPE (page->operations->type) != VM_UNINIT
+		|| page->uninit.page_initializer (page, page->uninit.type, kva);
+}
+
+/* If PAGE's part of its file is already in a frame, maps PAGE to
+ * the frame, first initializing it without its initializer if it
+ * has never been loaded, and returns true.  The caller must hold
+ * frame_lock. */
+static bool
+file_frame_claim (struct page *page) {
+	struct frame key, *frame;
+	struct hash_elem *e;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (!file_frame_key (page, &key))
+		return false;
+	e = hash_find (&file_frames, &key.file_elem);
+	if (e == NULL)
+		return false;
+	frame = hash_entry (e, struct frame, file_elem);
+
+	if (!pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				page->writable))
+		return false;
+	if (!page_init_loaded (page, frame->kva)) {
+		pml4_clear_page (page->owner->pml4, page->va);
+		return false;
+	}
+	frame_attach (frame, page);
+	file_share_cnt++;
+	return true;
+}
+
+/* Enters FRAME, into which a page of a file has just been loaded,
+ * in file_frames under KEY, the key file_frame_key() gave for the
+ * page before it was loaded.  The caller must hold frame_lock. */
 static void
-vm_stack_growth (void *addr UNUSED) {
+file_frame_insert (struct frame *frame, const struct frame *key) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (frame->file_inode == NULL);
+
+	frame->file_inode = key->file_inode;
+	frame->file_ofs = key->file_ofs;
+	frame->file_bytes = key->file_bytes;
+	frame->file_text = key->file_text;
+	if (hash_insert (&file_frames, &frame->file_elem) != NULL)
+		frame->file_inode = NULL;
+}
+
+/* Returns a hash value for the file frame that E is in. */
+static uint64_t
+file_frame_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct frame *f = hash_entry (e, struct frame, file_elem);
+	return hash_bytes (&f->file_inode, sizeof f->file_inode)
+		^ hash_int (f->file_ofs);
 }
 
-/* Handle the fault on write_protected page */
+/* Returns true if the file frame that A is in precedes the one that
+ * B is in. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+file_frame_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct frame *a = hash_entry (a_, struct frame, file_elem);
+	const struct frame *b = hash_entry (b_, struct frame, file_elem);
+
+	if (a->file_inode != b->file_inode)
+		return a->file_inode < b->file_inode;
+	if (a->file_ofs != b->file_ofs)
+		return a->file_ofs < b->file_ofs;
+	if (a->file_bytes != b->file_bytes)
+		return a->file_bytes < b->file_bytes;
+	return a->file_text < b->file_text;
+}
+
+/* Initializer for the pages of a file-backed region AUX: loads PAGE
+ * from the region's file.
+ *
+ * Fault-around: the pages next to PAGE that are yet to be loaded,
+ * within the aligned window of vm_fault_around pages that contains
+ * it, are read in the same request, which covers whole sectors of
+ * the file since a region's offset is page aligned, and mapped too,
+ * as far as there are free frames.  A program going through its
+ * code or data in order then faults once per window, not per page.
+ * Called with frame_lock held, from vm_do_claim_page(). */
+bool
+vm_region_load (struct page *page, void *aux) {
+	struct vm_region *r = aux;
+	struct supplemental_page_table *spt = &page->owner->spt;
+	size_t window = vm_fault_around;
+	uint8_t *lo, *hi, *first, *last, *va;
+	size_t ofs, length, read_bytes = 0;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (page->region == r && r->file != NULL);
+
+	/* The file part of a mapping comes from the page cache, and its
+	 * neighbours must too, so only the zeros past it get here. */
+	if (window < 1 || r->kind == REGION_MMAP)
+		window = 1;
+	else if (window > FAULT_AROUND_MAX)
+		window = FAULT_AROUND_MAX;
+
+	/* Find the run of pending pages around PAGE in its window. */
+	lo = (uint8_t *) ROUND_DOWN ((uint64_t) page->va, window * PGSIZE);
+	hi = lo + window * PGSIZE;
+	if (lo < r->start)
+		lo = r->start;
+	if (hi > r->end)
+		hi = r->end;
+	first = page->va;
+	while (first > lo
+			&& region_page_pending (spt_find_page (spt, first - PGSIZE), r))
+		first -= PGSIZE;
+	last = (uint8_t *) page->va + PGSIZE;
+	while (last < hi && region_page_pending (spt_find_page (spt, last), r))
+		last += PGSIZE;
+
+	/* Read the file's part of the run, zero the rest. */
+	ofs = first - r->start;
+	length = last - first;
+	if (ofs < r->file_bytes)
+		read_bytes = r->file_bytes - ofs < length ? r->file_bytes - ofs : length;
+	if (file_read_at (r->file, region_buf, read_bytes, r->ofs + ofs)
+			!= (off_t) read_bytes)
+		return false;
+	memset (region_buf + read_bytes, 0, length - read_bytes);
+	load_read_cnt++;
+
+	memcpy (page->frame->kva, region_buf + ((uint8_t *) page->va - first),
+			PGSIZE);
+	load_page_cnt++;
+
+	/* Put the other pages in memory, initialized as their first fault
+	 * would do. */
+	for (va = first; va < last; va += PGSIZE) {
+		struct page *p = spt_find_page (spt, va);
+		struct frame key;
+		bool shared;
+
+		if (p == page || file_frame_claim (p))
+			continue;
+		shared = file_frame_key (p, &key);
+		if (!vm_install_page (p, region_buf + (va - first)))
+			break;
+		if (!page_init_loaded (p, p->frame->kva))
+			return false;
+		if (shared)
+			file_frame_insert (p->frame, &key);
+		load_around_cnt++;
+	}
+	return true;
+}
+
+/* Passes the file pages of region R in SPT from START up to END that
+ * are in memory and have been modified through any mapping to the
+ * page cache, whose pages they are, and marks them clean.  The cache
+ * writes them to the file in its own time.  Takes frame_lock if the
+ * caller does not hold it already. */
+void
+vm_region_writeback (struct supplemental_page_table *spt,
+		struct vm_region *r, void *start, void *end) {
+	uint8_t *va;
+	bool held;
+
+	ASSERT (r->file != NULL);
+
+	held = lock_held_by_current_thread (&frame_lock);
+	if (!held)
+		lock_acquire (&frame_lock);
+	for (va = start; va < (uint8_t *) end; va += PGSIZE) {
+		struct page *page = spt_find_page (spt, va);
+
+		/* Other frames hold the zeros past the end of the file. */
+		if (page != NULL && page->frame != NULL
+				&& page->frame->cache != NULL
+				&& frame_is_dirty (page->frame)) {
+			frame_clear_dirty (page->frame);
+			page_cache_set_dirty (page->frame->cache);
+			wb_page_cnt++;
+		}
+	}
+	if (!held)
+		lock_release (&frame_lock);
+}
+
+/* Growing the stack.
+ *
+ * The stack region reserves vm_stack_pages pages below USER_STACK,
+ * and a page is added to it on the first access.  When the page
+ * just above the new one is already there, the stack is growing
+ * down page by page, and the STACK_PREFAULT - 1 pages below are put
+ * in memory too, as long as there are free frames, saving a fault
+ * each. */
+static bool
+vm_stack_growth (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vm_region *r = spt_find_region (spt, addr);
+	uint8_t *va = pg_round_down (addr);
+	uint8_t *lo;
+
+	ASSERT (r != NULL && r->kind == REGION_STACK);
+
+	if (!vm_alloc_page (VM_ANON, va, true) || !vm_claim_page (va))
+		return false;
+	stack_grow_cnt++;
+	if (va + PGSIZE >= r->end || spt_find_page (spt, va + PGSIZE) == NULL)
+		return true;
+
+	lo = va - (STACK_PREFAULT - 1) * PGSIZE;
+	if (lo < r->start)
+		lo = r->start;
+	lock_acquire (&frame_lock);
+	for (va -= PGSIZE; va >= lo; va -= PGSIZE) {
+		struct page *page;
+
+		if (spt_find_page (spt, va) != NULL
+				|| !vm_alloc_page (VM_ANON, va, true))
+			break;
+		page = spt_find_page (spt, va);
+		if (!vm_install_page (page, NULL)) {
+			spt_remove_page (spt, page);
+			break;
+		}
+		anon_initializer (page, VM_ANON, page->frame->kva);
+		stack_prefault_cnt++;
+	}
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Returns true if a fault at ADDR, with the user stack pointer at
+ * RSP, is a legitimate access to a stack page that does not exist
+ * yet: one in the stack region, at or above RSP, or just below it,
+ * where PUSH writes before moving RSP.  Anything else in the region
+ * hits the unused part of the stack, and is treated as a stray
+ * access. */
+static bool
+is_stack_access (struct supplemental_page_table *spt, const void *addr,
+		uintptr_t rsp) {
+	struct vm_region *r = spt_find_region (spt, addr);
+
+	return r != NULL && r->kind == REGION_STACK
+		&& (uintptr_t) addr >= rsp - 8;
+}
+
+/* Handle the fault on write_protected page.
+ *
+ * PAGE is writable but was mapped read-only because it shares its
+ * frame with the pages of other processes since a fork().  Gives it
+ * a copy of its own, or, if the others have let go of the frame in
+ * the meantime, lets it write to the frame. */
+static bool
+vm_handle_wp (struct page *page) {
+	struct frame *frame;
+	bool success = true;
+
+	lock_acquire (&frame_lock);
+	if (page->frame == NULL) {
+		/* Evicted since the fault; the retried access will bring it
+		 * back. */
+		lock_release (&frame_lock);
+		return true;
+	}
+
+	if (page->frame->ref_cnt == 1)
+		cow_reuse_cnt++;
+	else {
+		frame = vm_get_frame ();
+		if (page->frame != NULL) {
+			memcpy (frame->kva, page->frame->kva, PGSIZE);
+			frame_detach (page);
+			frame_attach (frame, page);
+		} else {
+			/* Evicted to make room: read it back into the new frame. */
+			frame_attach (frame, page);
+			success = swap_in (page, frame->kva);
+		}
+		cow_copy_cnt++;
+	}
+
+	/* Clearing the old mapping flushes it from the TLB. */
+	pml4_clear_page (page->owner->pml4, page->va);
+	success = success && pml4_set_page (page->owner->pml4, page->va,
+			page->frame->kva, true);
+	if (!success)
+		vm_release_frame (page);
+	lock_release (&frame_lock);
+	return success;
 }
 
 /* Return true on success */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
 	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
 
+	/* Validate the fault.  In the kernel, the user's rsp is the one
+	 * saved on entry to the system call. */
+	if (addr == NULL || !is_user_vaddr (addr))
+		return false;
+	page = spt_find_page (spt, addr);
+	if (page == NULL) {
+		uintptr_t rsp = user ? f->rsp : thread_current ()->user_rsp;
+		struct vm_region *r = spt_find_region (spt, addr);
+
+		if (r != NULL && vm_region_large (r, addr))
+			return not_present && vm_large_fault (r, addr);
+		return is_stack_access (spt, addr, rsp) && vm_stack_growth (addr);
+	}
+	if (write && !page->writable)
+		return false;
+
+	/* A write to a present page that may be written is to a page
+	 * shared copy-on-write. */
+	if (!not_present)
+		return write && vm_handle_wp (page);
 	return vm_do_claim_page (page);
 }
 
@@ -150,9 +1205,10 @@ vm_dealloc_page (struct page *page) {
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = spt_find_page (&thread_current ()->spt, va);
+	if (page == NULL)
+		return false;
 
 	return vm_do_claim_page (page);
 }
@@ -160,31 +1216,169 @@ vm_claim_page (void *va UNUSED) {
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	struct frame *frame, key;
+	bool shared, success;
+
+	lock_acquire (&frame_lock);
+	if (file_frame_claim (page)) {
+		lock_release (&frame_lock);
+		return true;
+	}
+	shared = file_frame_key (page, &key);
+	if (shared && !key.file_text && key.file_bytes > 0)
+		frame = vm_get_cache_frame (key.file_inode, key.file_ofs);
+	else
+		frame = vm_get_frame ();
 
 	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	frame_attach (frame, page);
+
+	/* Bring in the contents, unless the page cache has, then map the
+	 * page. */
+	success = (frame->cache != NULL
+			? page_init_loaded (page, frame->kva) : swap_in (page, frame->kva))
+		&& pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				page->writable);
+	if (!success)
+		vm_release_frame (page);
+	else if (shared)
+		file_frame_insert (frame, &key);
+	lock_release (&frame_lock);
+	return success;
+}
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+/* Returns a hash value for the page that E is in. */
+static uint64_t
+page_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page *p = hash_entry (e, struct page, spt_elem);
+	return hash_bytes (&p->va, sizeof p->va);
+}
 
-	return swap_in (page, frame->kva);
+/* Returns true if the page that A is in precedes the one that B
+ * is in. */
+static bool
+page_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct page, spt_elem)->va
+		< hash_entry (b, struct page, spt_elem)->va;
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	hash_init (&spt->pages, page_hash, page_less, NULL);
+	list_init (&spt->regions);
 }
 
-/* Copy supplemental page table from src to dst */
+/* Adds to DST a copy of SRC's page PARENT.  A page in memory shares
+ * PARENT's frame: a file page writably, since writes to it go back to
+ * the file anyway, and an anonymous page copy-on-write, mapped
+ * read-only for both processes.  A page in swap shares its slot. */
+static bool
+page_copy (struct supplemental_page_table *dst, struct page *parent) {
+	struct page *page = kmem_cache_alloc (page_cache);
+	bool shared;
+
+	if (page == NULL)
+		return false;
+	*page = *parent;
+	page->frame = NULL;
+	page->owner = thread_current ();
+	if (!spt_insert_page (dst, page)) {
+		kmem_cache_free (page_cache, page);
+		return false;
+	}
+
+	if (VM_TYPE (page->operations->type) == VM_UNINIT) {
+		/* Loaders pass the page's region to the initializer. */
+		if (page->uninit.aux == parent->region && parent->region != NULL)
+			page->uninit.aux = page->region;
+		return true;
+	}
+
+	lock_acquire (&frame_lock);
+	if (parent->frame != NULL) {
+		shared = page_get_type (page) == VM_FILE;
+		if (!pml4_set_page (page->owner->pml4, page->va, parent->frame->kva,
+					page->writable && shared)) {
+			lock_release (&frame_lock);
+			return false;
+		}
+		if (parent->writable && !shared) {
+			pml4_clear_page (parent->owner->pml4, parent->va);
+			pml4_set_page (parent->owner->pml4, parent->va,
+					parent->frame->kva, false);
+		}
+		frame_attach (parent->frame, page);
+	} else if (page_get_type (page) == VM_ANON
+			&& page->anon.slot != BITMAP_ERROR)
+		anon_share_slot (page->anon.slot);
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Copy supplemental page table from src to dst.
+ * DST must be the current thread's, and SRC its parent's, which is
+ * waiting in fork().  No page is copied yet: see page_copy(). */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct hash_iterator i;
+	struct list_elem *e;
+
+	ASSERT (dst == &thread_current ()->spt);
+
+	for (e = list_begin (&src->regions); e != list_end (&src->regions);
+			e = list_next (e)) {
+		struct vm_region *r = list_entry (e, struct vm_region, elem);
+		struct vm_region *copy = spt_add_region (dst, r->start,
+				r->end - r->start, r->kind, r->writable);
+
+		if (copy == NULL)
+			return false;
+		copy->ofs = r->ofs;
+		copy->file_bytes = r->file_bytes;
+		if (r->file != NULL && (copy->file = file_reopen (r->file)) == NULL)
+			return false;
+		if (copy->kind == REGION_CODE)
+			file_deny_write (copy->file);
+		if (r->large != NULL && !region_copy_large (copy, r))
+			return false;
+	}
+
+	hash_first (&i, &src->pages);
+	while (hash_next (&i))
+		if (!page_copy (dst, hash_entry (hash_cur (&i), struct page,
+						spt_elem)))
+			return false;
+	return true;
+}
+
+/* Releases the page that E is in, for hash_destroy(). */
+static void
+page_destructor (struct hash_elem *e, void *aux UNUSED) {
+	vm_dealloc_page (hash_entry (e, struct page, spt_elem));
 }
 
 /* Free the resource hold by the supplemental page table */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	struct list_elem *e;
+
+	/* Write back mapped files in as few requests as possible, then
+	 * destroy all the pages, then the regions. */
+	for (e = list_begin (&spt->regions); e != list_end (&spt->regions);
+			e = list_next (e)) {
+		struct vm_region *r = list_entry (e, struct vm_region, elem);
+		if (r->kind == REGION_MMAP)
+			vm_region_writeback (spt, r, r->start, r->end);
+	}
+	hash_clear (&spt->pages, page_destructor);
+	while (!list_empty (&spt->regions)) {
+		struct vm_region *r = list_entry (list_pop_front (&spt->regions),
+				struct vm_region, elem);
+		region_free_large (r);
+		file_close (r->file);
+		free (r);
+	}
 }